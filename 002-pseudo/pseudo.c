@@ -5,7 +5,20 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/string.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+
+#define CREATE_TRACE_POINTS
+#include "pseudo_trace.h"
+
 #define DEV_MEM_SIZE 512
+#define FIFO_SIZE_DEFAULT 4096
+#define FIFO_SIZE_MAX (64 * 1024 * 1024)
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("AnhLN");
@@ -23,37 +36,98 @@ struct cdev pcd_cdev;
 struct class *class_pcd;
 struct device *device_pcd;
 
+/* FIFO mode turns the device into a blocking byte stream instead of a seekable buffer */
+static bool fifo_mode;
+module_param(fifo_mode, bool, 0444);
+MODULE_PARM_DESC(fifo_mode, "Use the device as a blocking FIFO instead of a 512 byte buffer");
+
+static unsigned int fifo_size = FIFO_SIZE_DEFAULT;
+module_param(fifo_size, uint, 0444);
+MODULE_PARM_DESC(fifo_size, "Size of the FIFO ring in bytes, rounded up to a power of two");
+
+/* Ring of the FIFO mode. head and tail run freely, masking them with
+ * size - 1 gives the position in buf, head - tail is the fill level */
+struct pcd_fifo {
+	char *buf;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+	struct mutex lock;
+	wait_queue_head_t read_wq;
+	wait_queue_head_t write_wq;
+};
+
+struct pcd_fifo pcd_fifo;
 
 /* Function prototypes */
 loff_t pcd_lseek(struct file *filp, loff_t off, int whence);
-ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
-ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 int pcd_open(struct inode *inode, struct file *filp);
 int pcd_release(struct inode *inode, struct file *filp);
+ssize_t pcd_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from);
+__poll_t pcd_fifo_poll(struct file *filp, poll_table *wait);
 
 /*file operations of the driver*/
 struct file_operations pcd_fops = {
 	.owner = THIS_MODULE,
 	.open = pcd_open,
-	.read = pcd_read,
-	.write = pcd_write,
+	.read_iter = pcd_read_iter,
+	.write_iter = pcd_write_iter,
 	.llseek = pcd_lseek,
 	.release = pcd_release,
 };
 
+/*file operations of the driver in FIFO mode, the stream has no file position*/
+struct file_operations pcd_fifo_fops = {
+	.owner = THIS_MODULE,
+	.open = pcd_open,
+	.read_iter = pcd_fifo_read_iter,
+	.write_iter = pcd_fifo_write_iter,
+	.poll = pcd_fifo_poll,
+	.release = pcd_release,
+};
+
+static int pcd_fifo_init(void)
+{
+	if (fifo_size < 2 || fifo_size > FIFO_SIZE_MAX) {
+		printk(KERN_ALERT "Invalid fifo_size %u\n", fifo_size);
+		return -EINVAL;
+	}
+
+	pcd_fifo.size = roundup_pow_of_two(fifo_size);
+	pcd_fifo.buf = kvmalloc(pcd_fifo.size, GFP_KERNEL);
+	if (!pcd_fifo.buf)
+		return -ENOMEM;
+
+	mutex_init(&pcd_fifo.lock);
+	init_waitqueue_head(&pcd_fifo.read_wq);
+	init_waitqueue_head(&pcd_fifo.write_wq);
+	printk(KERN_INFO "FIFO mode, ring size %u bytes\n", pcd_fifo.size);
+	return 0;
+}
+
 static int __init pcd_driver_init(void)
 {
 	int ret;
+
+	if (fifo_mode) {
+		ret = pcd_fifo_init();
+		if (ret)
+			goto out;
+	}
+
     /*1> Dynamically allocate a device number*/
     ret = alloc_chrdev_region(&device_number, 0, 1, "pseudo_device");
 	if (ret < 0) {
 		printk(KERN_ALERT "Failed to allocate device number\n");
-		goto out;
+		goto free_fifo;
 	}
 	printk(KERN_INFO "%s :Device number allocated <major>:<minor> %d:%d\n",__func__ ,MAJOR(device_number), MINOR(device_number));
 
     /*2> Initialize the cdev structure*/
-    cdev_init(&pcd_cdev, &pcd_fops);
+    cdev_init(&pcd_cdev, fifo_mode ? &pcd_fifo_fops : &pcd_fops);
 
     /*3> Register a device (cdev struct) with VFS*/
 	pcd_cdev.owner = THIS_MODULE;
@@ -89,6 +163,8 @@ cdev_del:
 	cdev_del(&pcd_cdev);
 unreg_chrdev:
 	unregister_chrdev_region(device_number, 1);
+free_fifo:
+	kvfree(pcd_fifo.buf);
 out: 
 	return ret;
 }
@@ -102,13 +178,12 @@ static void __exit pcd_driver_exit(void)
 	/*8> Unregister the device number*/
 	cdev_del(&pcd_cdev);
 	unregister_chrdev_region(device_number, 1);
+	kvfree(pcd_fifo.buf);
 	printk(KERN_INFO "Pseudo device driver exited\n");
 }
 
-loff_t pcd_lseek(struct file *filp, loff_t off, int whence)
+static loff_t pcd_do_lseek(struct file *filp, loff_t off, int whence)
 {	
-	printk(KERN_INFO "lseek requested\n");
-	printk(KERN_INFO "current file offset: %lld\n", filp->f_pos);
 	loff_t temp;
 	switch (whence) {
 		case SEEK_SET: 
@@ -134,18 +209,17 @@ loff_t pcd_lseek(struct file *filp, loff_t off, int whence)
 		default:
 			return -EINVAL; // Invalid argument
 	}
-	printk(KERN_INFO "lseek completed, new file offset: %lld\n", filp->f_pos);
     return filp->f_pos;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+static ssize_t pcd_do_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	printk(KERN_INFO "read requested\n");
-	printk(KERN_INFO "current file offset: %lld\n", *off);
-	
+	loff_t *off = &iocb->ki_pos;
+	size_t len = iov_iter_count(to);
+	size_t copied;
+
 	/* Check if we're at or beyond the end of the buffer */
 	if (*off >= DEV_MEM_SIZE) {
-		printk(KERN_INFO "EOF reached\n");
 		return 0; /* EOF */
 	}
 	
@@ -155,24 +229,29 @@ ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
 		len = DEV_MEM_SIZE - *off;
 	}
 
-	/*coppy to user*/
-	if(copy_to_user(buf, device_buffer + *off, len))
+	/*copy to user, scattering over all the iovecs of a readv() in one go*/
+	copied = copy_to_iter(device_buffer + *off, len, to);
+	if(!copied && len)
 	{
-		printk(KERN_ALERT "Failed to copy data to user\n");
 		return -EFAULT;
 	}
 
 	/*Update the offset*/
-	*off += len;
-	printk(KERN_INFO "read completed, bytes read: %zu\n", len);
-	printk(KERN_INFO "updated file offset: %lld\n", *off);
-    return len;
+	*off += copied;
+    return copied;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+static ssize_t pcd_do_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	printk(KERN_INFO "write requested\n");
-	printk(KERN_INFO "current file offset: %lld\n", *off);
+	loff_t *off = &iocb->ki_pos;
+	size_t len = iov_iter_count(from);
+	size_t copied;
+
+	/* A pwrite() beyond the buffer would wrap the length below */
+	if (*off >= DEV_MEM_SIZE) {
+		return -ENOSPC;
+	}
+
 	/* Adjust the 'count'*/
 	if((*off + len) > DEV_MEM_SIZE)
 	{
@@ -181,27 +260,80 @@ ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t
 
 	if(len <= 0)
 	{
-		printk(KERN_ALERT "No space left to write\n");
 		return -ENOMEM;
 	}
 
-	/*coppy from user*/
-	if(copy_from_user(device_buffer + *off, buf, len))
+	/*coppy from user, gathering all the iovecs of a writev() in one go*/
+	copied = copy_from_iter(device_buffer + *off, len, from);
+	if(!copied)
 	{
-		printk(KERN_ALERT "Failed to copy data from user\n");
 		return -EFAULT;
 	}
 	/*Update the offset*/
-	*off += len;
-	printk(KERN_INFO "write completed, bytes written: %zu\n", len);
-	printk(KERN_INFO "updated file offset: %lld\n", *off);
-	printk(KERN_INFO "Data in device buffer: %.*s\n", (int)len, device_buffer + *off - len);
-    return len;
+	*off += copied;
+    return copied;
+}
+
+/* The file operations below only wrap the ones above with a tracepoint.
+ * The clock is read only while the event is enabled, so tracing costs a
+ * static branch when it is off */
+static u64 pcd_trace_start(bool enabled)
+{
+	return enabled ? ktime_get_ns() : 0;
+}
+
+static u64 pcd_trace_duration(u64 start)
+{
+	return start ? ktime_get_ns() - start : 0;
+}
+
+loff_t pcd_lseek(struct file *filp, loff_t off, int whence)
+{
+	u64 start = pcd_trace_start(trace_pcd_lseek_enabled());
+	loff_t ret;
+
+	ret = pcd_do_lseek(filp, off, whence);
+	trace_pcd_lseek(MINOR(file_inode(filp)->i_rdev), off, whence, ret,
+			pcd_trace_duration(start));
+	return ret;
+}
+
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	u64 start = pcd_trace_start(trace_pcd_read_enabled());
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(to);
+	ssize_t ret;
+
+	ret = pcd_do_read_iter(iocb, to);
+	trace_pcd_read(MINOR(file_inode(iocb->ki_filp)->i_rdev), pos, len, ret,
+		       pcd_trace_duration(start));
+	return ret;
+}
+
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	u64 start = pcd_trace_start(trace_pcd_write_enabled());
+	loff_t pos = iocb->ki_pos;
+	size_t len = iov_iter_count(from);
+	ssize_t ret;
+
+	ret = pcd_do_write_iter(iocb, from);
+	trace_pcd_write(MINOR(file_inode(iocb->ki_filp)->i_rdev), pos, len, ret,
+			pcd_trace_duration(start));
+	return ret;
 }
 
 int pcd_open(struct inode *inode, struct file *filp)
 {
 	printk(KERN_INFO "Device opened\n");
+	/* in FIFO mode there is no file position, lseek/pread/pwrite fail with ESPIPE */
+	if (fifo_mode)
+		stream_open(inode, filp);
+	/* read_iter/write_iter never sleep on the buffer and the FIFO honours
+	 * IOCB_NOWAIT, so io_uring may issue requests inline instead of punting
+	 * them to a worker */
+	filp->f_mode |= FMODE_NOWAIT;
     return 0;
 }
 
@@ -213,5 +345,129 @@ int pcd_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+static unsigned int pcd_fifo_used(void)
+{
+	return READ_ONCE(pcd_fifo.head) - READ_ONCE(pcd_fifo.tail);
+}
+
+static bool pcd_fifo_nonblock(struct kiocb *iocb)
+{
+	return (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+}
+
+/* Take the ring lock, without sleeping for O_NONBLOCK and IOCB_NOWAIT callers */
+static int pcd_fifo_lock(bool nonblock)
+{
+	if (nonblock)
+		return mutex_trylock(&pcd_fifo.lock) ? 0 : -EAGAIN;
+	return mutex_lock_interruptible(&pcd_fifo.lock);
+}
+
+ssize_t pcd_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	bool nonblock = pcd_fifo_nonblock(iocb);
+	size_t len = iov_iter_count(to);
+	size_t copied, chunk;
+	unsigned int off;
+	int ret;
+
+	if (!len)
+		return 0;
+
+	/* Sleep until the writer has put something into the ring */
+	for (;;) {
+		ret = pcd_fifo_lock(nonblock);
+		if (ret)
+			return ret;
+		if (pcd_fifo.head != pcd_fifo.tail)
+			break;
+		mutex_unlock(&pcd_fifo.lock);
+
+		if (nonblock)
+			return -EAGAIN;
+		ret = wait_event_interruptible(pcd_fifo.read_wq, pcd_fifo_used() != 0);
+		if (ret)
+			return ret;
+	}
+
+	/* The data may wrap around the end of the ring, copy it in two parts */
+	len = min_t(size_t, len, pcd_fifo.head - pcd_fifo.tail);
+	off = pcd_fifo.tail & (pcd_fifo.size - 1);
+	chunk = min_t(size_t, len, pcd_fifo.size - off);
+	copied = copy_to_iter(pcd_fifo.buf + off, chunk, to);
+	if (copied == chunk && len > chunk)
+		copied += copy_to_iter(pcd_fifo.buf, len - chunk, to);
+	pcd_fifo.tail += copied;
+	mutex_unlock(&pcd_fifo.lock);
+
+	if (!copied)
+		return -EFAULT;
+
+	wake_up_interruptible(&pcd_fifo.write_wq);
+	return copied;
+}
+
+ssize_t pcd_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	bool nonblock = pcd_fifo_nonblock(iocb);
+	size_t len = iov_iter_count(from);
+	size_t copied, chunk;
+	unsigned int off;
+	int ret;
+
+	if (!len)
+		return 0;
+
+	/* Sleep until the reader has made room in the ring */
+	for (;;) {
+		ret = pcd_fifo_lock(nonblock);
+		if (ret)
+			return ret;
+		if (pcd_fifo.head - pcd_fifo.tail != pcd_fifo.size)
+			break;
+		mutex_unlock(&pcd_fifo.lock);
+
+		if (nonblock)
+			return -EAGAIN;
+		ret = wait_event_interruptible(pcd_fifo.write_wq,
+					       pcd_fifo_used() != pcd_fifo.size);
+		if (ret)
+			return ret;
+	}
+
+	/* Write as much as fits, the free space may wrap around the end of the ring */
+	len = min_t(size_t, len, pcd_fifo.size - (pcd_fifo.head - pcd_fifo.tail));
+	off = pcd_fifo.head & (pcd_fifo.size - 1);
+	chunk = min_t(size_t, len, pcd_fifo.size - off);
+	copied = copy_from_iter(pcd_fifo.buf + off, chunk, from);
+	if (copied == chunk && len > chunk)
+		copied += copy_from_iter(pcd_fifo.buf, len - chunk, from);
+	pcd_fifo.head += copied;
+	mutex_unlock(&pcd_fifo.lock);
+
+	if (!copied)
+		return -EFAULT;
+
+	wake_up_interruptible(&pcd_fifo.read_wq);
+	return copied;
+}
+
+__poll_t pcd_fifo_poll(struct file *filp, poll_table *wait)
+{
+	__poll_t mask = 0;
+	unsigned int used;
+
+	poll_wait(filp, &pcd_fifo.read_wq, wait);
+	poll_wait(filp, &pcd_fifo.write_wq, wait);
+
+	used = pcd_fifo_used();
+	if (used)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (used != pcd_fifo.size)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
 module_init(pcd_driver_init);
 module_exit(pcd_driver_exit);
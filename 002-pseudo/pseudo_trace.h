@@ -0,0 +1,81 @@
+/* Tracepoints of the pseudo device, see /sys/kernel/tracing/events/pseudo */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pseudo
+
+#if !defined(_PSEUDO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PSEUDO_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(pcd_io,
+
+	TP_PROTO(unsigned int minor, loff_t offset, size_t len, ssize_t ret, u64 duration_ns),
+
+	TP_ARGS(minor, offset, len, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(loff_t, offset)
+		__field(size_t, len)
+		__field(ssize_t, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->offset = offset;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("minor=%u offset=%lld len=%zu ret=%zd duration_ns=%llu",
+		  __entry->minor, __entry->offset, __entry->len, __entry->ret,
+		  __entry->duration_ns)
+);
+
+DEFINE_EVENT(pcd_io, pcd_read,
+	TP_PROTO(unsigned int minor, loff_t offset, size_t len, ssize_t ret, u64 duration_ns),
+	TP_ARGS(minor, offset, len, ret, duration_ns)
+);
+
+DEFINE_EVENT(pcd_io, pcd_write,
+	TP_PROTO(unsigned int minor, loff_t offset, size_t len, ssize_t ret, u64 duration_ns),
+	TP_ARGS(minor, offset, len, ret, duration_ns)
+);
+
+TRACE_EVENT(pcd_lseek,
+
+	TP_PROTO(unsigned int minor, loff_t offset, int whence, loff_t ret, u64 duration_ns),
+
+	TP_ARGS(minor, offset, whence, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(loff_t, offset)
+		__field(int, whence)
+		__field(loff_t, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->offset = offset;
+		__entry->whence = whence;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("minor=%u offset=%lld whence=%d ret=%lld duration_ns=%llu",
+		  __entry->minor, __entry->offset, __entry->whence, __entry->ret,
+		  __entry->duration_ns)
+);
+
+#endif /* _PSEUDO_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pseudo_trace
+#include <trace/define_trace.h>
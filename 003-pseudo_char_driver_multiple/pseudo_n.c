@@ -5,6 +5,8 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/string.h>
+#include <linux/uio.h>
+#include <linux/rwsem.h>
 
 #define MEM_SIZE_MAX_PCDEV1 1024
 #define MEM_SIZE_MAX_PCDEV2 512
@@ -29,6 +31,7 @@ struct pcdev_private_data
 	unsigned size; // Size of the device buffer
 	const char *serial_number; // Serial number of the device
 	int perm;
+	struct rw_semaphore rwsem; // Readers share the buffer, a writer owns it
 	struct cdev cdev; // Character device structure
 };
 
@@ -75,8 +78,8 @@ struct pcdrv_private_data pcdrv_data =
 
 /* Function prototypes */
 loff_t pcd_lseek(struct file *filp, loff_t off, int whence);
-ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
-ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 int pcd_open(struct inode *inode, struct file *filp);
 int pcd_release(struct inode *inode, struct file *filp);
 
@@ -84,8 +87,11 @@ int pcd_release(struct inode *inode, struct file *filp);
 struct file_operations pcd_fops = {
 	.owner = THIS_MODULE,
 	.open = pcd_open,
-	.read = pcd_read,
-	.write = pcd_write,
+	.read_iter = pcd_read_iter,
+	.write_iter = pcd_write_iter,
+	/* pipes are fed through read_iter/write_iter, without a user space bounce */
+	.splice_read = copy_splice_read,
+	.splice_write = iter_file_splice_write,
 	.llseek = pcd_lseek,
 	.release = pcd_release,
 };
@@ -115,6 +121,8 @@ static int __init pcd_driver_init(void)
         printk(KERN_INFO "%s: Device number <major>:<minor> %d:%d\n", 
                __func__, MAJOR(pcdrv_data.device_number + i), MINOR(pcdrv_data.device_number + i));
         
+        init_rwsem(&pcdrv_data.pcdev_data[i].rwsem);
+
         /* Initialize cdev */
         cdev_init(&pcdrv_data.pcdev_data[i].cdev, &pcd_fops);
         pcdrv_data.pcdev_data[i].cdev.owner = THIS_MODULE;
@@ -167,13 +175,16 @@ static void __exit pcd_driver_exit(void)
     printk(KERN_INFO "Pseudo device driver exited\n");
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     struct pcdev_private_data *pcdev_data;
+    loff_t *off = &iocb->ki_pos;
+    size_t len = iov_iter_count(to);
+    size_t copied;
     int minor_no;
     
     /* Get device data from inode */
-    minor_no = MINOR(filp->f_inode->i_rdev);
+    minor_no = MINOR(file_inode(iocb->ki_filp)->i_rdev);
     
     /* Validate minor number */
     if (minor_no >= NO_OF_DEVICES) {
@@ -203,26 +214,39 @@ ssize_t pcd_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
         len = pcdev_data->size - *off;
     }
     
-    /* Copy to user */
-    if (copy_to_user(buf, pcdev_data->buffer + *off, len)) {
+    /* Readers run in parallel, only a writer excludes them */
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!down_read_trylock(&pcdev_data->rwsem))
+            return -EAGAIN;
+    } else {
+        down_read(&pcdev_data->rwsem);
+    }
+    
+    /* Copy to user, scattering over all the iovecs of a readv() in one go */
+    copied = copy_to_iter(pcdev_data->buffer + *off, len, to);
+    up_read(&pcdev_data->rwsem);
+    if (!copied && len) {
         printk(KERN_ALERT "Failed to copy data to user\n");
         return -EFAULT;
     }
     
     /* Update offset */
-    *off += len;
-    printk(KERN_INFO "read completed, bytes read: %zu\n", len);
+    *off += copied;
+    printk(KERN_INFO "read completed, bytes read: %zu\n", copied);
     
-    return len;
+    return copied;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
     struct pcdev_private_data *pcdev_data;
+    loff_t *off = &iocb->ki_pos;
+    size_t len = iov_iter_count(from);
+    size_t copied;
     int minor_no;
     
     /* Get device data */
-    minor_no = MINOR(filp->f_inode->i_rdev);
+    minor_no = MINOR(file_inode(iocb->ki_filp)->i_rdev);
     
     /* Validate minor number */
     if (minor_no >= NO_OF_DEVICES) {
@@ -241,6 +265,12 @@ ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t
         return -EPERM;
     }
     
+    /* A pwrite() beyond the buffer would wrap the length below */
+    if (*off >= pcdev_data->size) {
+        printk(KERN_ALERT "No space left to write\n");
+        return -ENOSPC;
+    }
+    
     /* Adjust length */
     if ((*off + len) > pcdev_data->size) {
         len = pcdev_data->size - *off;
@@ -251,17 +281,27 @@ ssize_t pcd_write(struct file *filp, const char __user *buf, size_t len, loff_t
         return -ENOMEM;
     }
     
-    /* Copy from user */
-    if (copy_from_user(pcdev_data->buffer + *off, buf, len)) {
+    /* A writer owns the buffer, so readers never see a half written range */
+    if (iocb->ki_flags & IOCB_NOWAIT) {
+        if (!down_write_trylock(&pcdev_data->rwsem))
+            return -EAGAIN;
+    } else {
+        down_write(&pcdev_data->rwsem);
+    }
+    
+    /* Copy from user, gathering all the iovecs of a writev() in one go */
+    copied = copy_from_iter(pcdev_data->buffer + *off, len, from);
+    up_write(&pcdev_data->rwsem);
+    if (!copied) {
         printk(KERN_ALERT "Failed to copy data from user\n");
         return -EFAULT;
     }
     
     /* Update offset */
-    *off += len;
-    printk(KERN_INFO "write completed, bytes written: %zu\n", len);
+    *off += copied;
+    printk(KERN_INFO "write completed, bytes written: %zu\n", copied);
     
-    return len;
+    return copied;
 }
 
 int pcd_open(struct inode *inode, struct file *filp)
@@ -280,6 +320,10 @@ int pcd_open(struct inode *inode, struct file *filp)
     /* Store device data in private_data for easy access */
     filp->private_data = pcdev_data;
     
+    /* read_iter/write_iter only trylock the device for IOCB_NOWAIT requests,
+     * so io_uring may issue them inline instead of punting them to a worker */
+    filp->f_mode |= FMODE_NOWAIT;
+    
     printk(KERN_INFO "Device pcd%d opened (serial: %s, size: %u, perm: 0x%x)\n", 
            minor_no, pcdev_data->serial_number, pcdev_data->size, pcdev_data->perm);
     
@@ -9,6 +9,8 @@
 #include<linux/mod_devicetable.h>
 #include<linux/of.h>
 #include<linux/of_device.h>
+#include<linux/mm.h>
+#include<linux/highmem.h>
 #include "platform.h"
 
 
@@ -43,7 +45,10 @@ struct device_config pcdev_config[] =
 struct pcdev_private_data
 {
 	struct pcdev_platform_data pdata;
-	char *buffer;
+	/* the buffer is an array of single pages, large sizes need no
+	high order allocation */
+	struct page **pages;
+	unsigned long nr_pages;
 	dev_t dev_num;
 	struct cdev cdev;
 };
@@ -120,6 +125,37 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 	return filp->f_pos;
 }
 
+/*copy between user space and the device pages, the buffer is only contiguous
+within a page so the copy is split at every page boundary */
+static int pcd_copy_pages(struct pcdev_private_data *pcdev_data, loff_t pos, char __user *buff, size_t count, bool to_user)
+{
+	struct page *page;
+	unsigned long left;
+	size_t chunk;
+	void *vaddr;
+
+	while(count){
+		page = pcdev_data->pages[pos >> PAGE_SHIFT];
+		chunk = min_t(size_t,count,PAGE_SIZE - offset_in_page(pos));
+
+		vaddr = kmap(page);
+		if(to_user)
+			left = copy_to_user(buff,vaddr + offset_in_page(pos),chunk);
+		else
+			left = copy_from_user(vaddr + offset_in_page(pos),buff,chunk);
+		kunmap(page);
+
+		if(left)
+			return -EFAULT;
+
+		pos += chunk;
+		buff += chunk;
+		count -= chunk;
+	}
+
+	return 0;
+}
+
 ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
 {
 	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
@@ -135,7 +171,7 @@ ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_p
 		count = max_size - *f_pos;
 
 	/*copy to user */
-	if(copy_to_user(buff,pcdev_data->buffer+(*f_pos),count)){
+	if(pcd_copy_pages(pcdev_data,*f_pos,buff,count,true)){
 		return -EFAULT;
 	}
 
@@ -170,7 +206,7 @@ ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff
 	}
 
 	/*copy from user */
-	if(copy_from_user(pcdev_data->buffer+(*f_pos),buff,count)){
+	if(pcd_copy_pages(pcdev_data,*f_pos,(char __user *)buff,count,false)){
 		return -EFAULT;
 	}
 
@@ -236,6 +272,20 @@ struct file_operations pcd_fops=
 
 
 
+/*devres action which releases the pages of the device buffer */
+static void pcd_free_pages(void *data)
+{
+	struct pcdev_private_data *dev_data = data;
+	unsigned long i;
+
+	for(i = 0 ; i < dev_data->nr_pages ; i++){
+		if(dev_data->pages[i])
+			__free_page(dev_data->pages[i]);
+	}
+
+	kvfree(dev_data->pages);
+}
+
 /*Called when the device is removed from the system */
 int pcd_platform_driver_remove(struct platform_device *pdev)
 {
@@ -302,6 +352,8 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 {
 	int ret;
 
+	unsigned long i;
+
 	struct pcdev_private_data *dev_data;
 
 	struct pcdev_platform_data *pdata;
@@ -357,13 +409,27 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 
 
 	/*3. Dynamically allocate memory for the device buffer using size 
-	information from the platform data */
-	dev_data->buffer = devm_kzalloc(&pdev->dev,dev_data->pdata.size,GFP_KERNEL);
-	if(!dev_data->buffer){
+	information from the platform data. Pages are allocated one by one, so
+	org,size can be hundreds of MB without a high order allocation */
+	dev_data->nr_pages = DIV_ROUND_UP(dev_data->pdata.size,PAGE_SIZE);
+	dev_data->pages = kvcalloc(dev_data->nr_pages,sizeof(*dev_data->pages),GFP_KERNEL);
+	if(!dev_data->pages){
 		dev_info(dev,"Cannot allocate memory \n");
 		return -ENOMEM;
 	}
 
+	ret = devm_add_action_or_reset(dev,pcd_free_pages,dev_data);
+	if(ret)
+		return ret;
+
+	for(i = 0 ; i < dev_data->nr_pages ; i++){
+		dev_data->pages[i] = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+		if(!dev_data->pages[i]){
+			dev_info(dev,"Cannot allocate memory \n");
+			return -ENOMEM;
+		}
+	}
+
 	/*4. Get the device number */
 	dev_data->dev_num = pcdrv_data.device_num_base + pcdrv_data.total_devices;
 
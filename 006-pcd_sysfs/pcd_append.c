@@ -0,0 +1,120 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Append mode, see pcd_ioctl.h for the record format. Appenders only share
+append_sem for read and the tail of the log, so they never wait for each
+other: each one reserves its record with a compare-and-exchange on the tail,
+copies its data in and then sets the commit flag of the header. */
+
+static int pcd_append_commit(struct pcd_buffer *buf, loff_t off, u32 len, u32 flags)
+{
+	struct pcd_log_hdr *hdr;
+	struct page *page;
+	void *vaddr;
+
+	/*records are aligned, so a header never straddles two pages */
+	page = pcd_buffer_write_page(buf,off >> PAGE_SHIFT,true);
+	if(IS_ERR(page))
+		return PTR_ERR(page);
+
+	vaddr = kmap_atomic(page);
+	hdr = vaddr + offset_in_page(off);
+	hdr->len = len;
+	/*readers which see the flag also see len and the data */
+	smp_wmb();
+	WRITE_ONCE(hdr->flags,flags);
+	kunmap_atomic(vaddr);
+
+	return 0;
+}
+
+ssize_t pcd_append_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	size_t count = iov_iter_count(from);
+
+	struct pcd_buffer *buf;
+
+	struct page *page;
+
+	size_t reclen;
+
+	s64 off;
+
+	ssize_t ret;
+
+	int err, idx;
+
+	if(!count)
+		return 0;
+
+	if(iocb->ki_flags & IOCB_NOWAIT){
+		if(!percpu_down_read_trylock(&pcdev_data->append_sem))
+			return -EAGAIN;
+	}else{
+		percpu_down_read(&pcdev_data->append_sem);
+	}
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	reclen = ALIGN(sizeof(struct pcd_log_hdr) + count,PCD_LOG_ALIGN);
+
+	/*the only point where appenders meet. A record which does not fit is
+	refused without moving the tail, so smaller ones still go in after it */
+	off = atomic64_read(&pcdev_data->append_tail);
+	do{
+		if(off + reclen > buf->size){
+			ret = -ENOSPC;
+			goto out;
+		}
+		/*the page of the header is in place before the record is ours, and
+		append_sem keeps it there, so the commit below cannot run out of
+		memory and leave a header readers would wait on forever */
+		page = pcd_buffer_write_page(buf,off >> PAGE_SHIFT,true);
+		if(IS_ERR(page)){
+			ret = PTR_ERR(page);
+			goto out;
+		}
+	}while(!atomic64_try_cmpxchg(&pcdev_data->append_tail,&off,off + reclen));
+
+	ret = pcd_buffer_copy_from_iter(buf,off + sizeof(struct pcd_log_hdr),count,from);
+
+	/*the space is taken either way, a short copy is committed as discarded so
+	readers can step over it */
+	if(ret == count){
+		err = pcd_append_commit(buf,off,count,PCD_LOG_COMMITTED);
+	}else{
+		err = pcd_append_commit(buf,off,count,PCD_LOG_COMMITTED | PCD_LOG_DISCARD);
+		if(ret >= 0)
+			ret = -EFAULT;
+	}
+	if(err && ret >= 0)
+		ret = err;
+
+	if(ret > 0){
+		iocb->ki_pos = off + reclen;
+		pcd_status_update(pcdev_data,off,reclen);
+	}
+
+out:
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	percpu_up_read(&pcdev_data->append_sem);
+
+	return ret;
+}
+
+/*called with mode_lock held and the device closed. Old data must not look
+like committed records */
+int pcd_append_reset(struct pcdev_private_data *pcdev_data)
+{
+	ssize_t ret;
+
+	atomic64_set(&pcdev_data->append_tail,0);
+
+	ret = pcd_buffer_fill(pcdev_data,0,pcdev_data->pdata.size,0);
+
+	return ret < 0 ? ret : 0;
+}
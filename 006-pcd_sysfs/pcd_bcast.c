@@ -0,0 +1,408 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_trace.h"
+
+
+/*Broadcast mode. The buffer of the device is a ring which a single writer
+appends to, and which every open file consumes from at its own pace, either
+with read() or straight out of a read-only mmap of the ring. Each open file
+has a control page holding its position, like a perf ring buffer. The writer
+never waits for readers, it overwrites what they did not consume and tells
+them so through their control page */
+
+struct pcd_bcast_reader
+{
+	struct pcdev_private_data *pcdev_data;
+	struct page *ctrl_page;
+	struct pcd_bcast_ctrl *ctrl;
+	/* on pcd_bcast.readers */
+	struct list_head node;
+};
+
+static u64 pcd_bcast_head(struct pcd_bcast *bcast)
+{
+	u64 head;
+
+	spin_lock(&bcast->lock);
+	head = bcast->head;
+	spin_unlock(&bcast->lock);
+
+	return head;
+}
+
+/*move the head past 'n' newly written bytes and tell every reader about it */
+static void pcd_bcast_publish(struct pcd_bcast *bcast, u64 head, size_t n, int size)
+{
+	struct pcd_bcast_reader *reader;
+
+	struct pcd_bcast_ctrl *ctrl;
+
+	u64 behind;
+
+	/*the data is in place before any reader sees the new head */
+	smp_wmb();
+
+	spin_lock(&bcast->lock);
+	bcast->head = head;
+	list_for_each_entry(reader,&bcast->readers,node){
+		ctrl = reader->ctrl;
+		/*everything before head - size is gone now */
+		behind = head - READ_ONCE(ctrl->data_tail);
+		if(behind > size)
+			ctrl->lost += min_t(u64,behind - size,n);
+		WRITE_ONCE(ctrl->data_head,head);
+	}
+	spin_unlock(&bcast->lock);
+
+	wake_up_interruptible(&bcast->wq);
+}
+
+static ssize_t pcd_bcast_do_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcd_bcast_reader *reader = iocb->ki_filp->private_data;
+
+	struct pcdev_private_data *pcdev_data = reader->pcdev_data;
+
+	size_t count = iov_iter_count(from);
+
+	struct pcd_buffer *buf;
+
+	size_t chunk;
+
+	ssize_t ret, n;
+
+	u64 head;
+
+	u32 pos;
+
+	if(!count)
+		return 0;
+
+	down_write(&pcdev_data->rwsem);
+
+	buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->rwsem));
+
+	/*a write longer than the ring is cut to its size, the caller gets a
+	short write and the rest goes in with the next one */
+	count = min_t(size_t,count,buf->size);
+
+	head = pcdev_data->bcast.head;
+	div_u64_rem(head,buf->size,&pos);
+
+	/*readers copy without any lock, they find out afterwards whether we came
+	around while they did. The range is announced before it is written */
+	WRITE_ONCE(pcdev_data->bcast.reserve,max(pcdev_data->bcast.reserve,head + count));
+	smp_wmb();
+
+	chunk = min_t(size_t,count,buf->size - pos);
+	ret = pcd_buffer_copy_from_iter(buf,pos,chunk,from);
+	if(ret == chunk && count > chunk){
+		n = pcd_buffer_copy_from_iter(buf,0,count - chunk,from);
+		if(n > 0)
+			ret += n;
+	}
+
+	if(ret > 0)
+		pcd_bcast_publish(&pcdev_data->bcast,head + ret,ret,buf->size);
+
+	up_write(&pcdev_data->rwsem);
+
+	if(ret > 0)
+		pcd_status_update(pcdev_data,head,ret);
+
+	return ret ? ret : -EFAULT;
+}
+
+/*An overrun reader gets -EOVERFLOW once, and then continues with the oldest
+data still in the ring. Readers never lock out the writer: they copy without
+rwsem and check afterwards that the writer did not overwrite what they read */
+static ssize_t pcd_bcast_do_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+
+	struct pcd_bcast_reader *reader = filp->private_data;
+
+	struct pcdev_private_data *pcdev_data = reader->pcdev_data;
+
+	struct pcd_bcast *bcast = &pcdev_data->bcast;
+
+	struct pcd_bcast_ctrl *ctrl = reader->ctrl;
+
+	size_t count = iov_iter_count(to);
+
+	struct pcd_buffer *buf;
+
+	u64 head, tail, reserve;
+
+	size_t chunk, n;
+
+	u32 pos;
+
+	int ret, idx;
+
+	if(!count)
+		return 0;
+
+	for(;;){
+		head = pcd_bcast_head(bcast);
+		if(head != READ_ONCE(ctrl->data_tail))
+			break;
+
+		if((iocb->ki_flags & IOCB_NOWAIT) || (filp->f_flags & O_NONBLOCK))
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(bcast->wq,
+				pcd_bcast_head(bcast) != READ_ONCE(ctrl->data_tail));
+		if(ret)
+			return ret;
+	}
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	tail = READ_ONCE(ctrl->data_tail);
+	if(head - tail > buf->size){
+		WRITE_ONCE(ctrl->data_tail,head - buf->size);
+		srcu_read_unlock(&pcdev_data->srcu,idx);
+		return -EOVERFLOW;
+	}
+
+	count = min_t(u64,count,head - tail);
+	div_u64_rem(tail,buf->size,&pos);
+
+	chunk = min_t(size_t,count,buf->size - pos);
+	n = pcd_buffer_copy_to_iter(buf,pos,chunk,to);
+	if(n == chunk && count > chunk)
+		n += pcd_buffer_copy_to_iter(buf,0,count - chunk,to);
+
+	/*pairs with the barrier after the writer announced its range. Anything
+	before reserve - size may have changed under the copy */
+	smp_rmb();
+	reserve = READ_ONCE(bcast->reserve);
+	if(reserve - tail > buf->size){
+		WRITE_ONCE(ctrl->data_tail,reserve - buf->size);
+		srcu_read_unlock(&pcdev_data->srcu,idx);
+		return -EOVERFLOW;
+	}
+
+	WRITE_ONCE(ctrl->data_tail,tail + n);
+
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+
+	return n ? n : -EFAULT;
+}
+
+/*traced and counted like the pcd_syscalls.c wrappers, the offset is the free
+running position in the ring */
+static ssize_t pcd_bcast_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcd_bcast_reader *reader = iocb->ki_filp->private_data;
+
+	struct pcdev_private_data *pcdev_data = reader->pcdev_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_read_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 pos = READ_ONCE(reader->ctrl->data_tail);
+
+	size_t count = iov_iter_count(to);
+
+	u64 duration;
+
+	ssize_t ret;
+
+	ret = pcd_bcast_do_read_iter(iocb,to);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_read(MINOR(pcdev_data->dev_num),pos,count,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_READ,ret,duration);
+
+	return ret;
+}
+
+static ssize_t pcd_bcast_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcd_bcast_reader *reader = iocb->ki_filp->private_data;
+
+	struct pcdev_private_data *pcdev_data = reader->pcdev_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_write_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 pos = pcd_bcast_head(&pcdev_data->bcast);
+
+	size_t count = iov_iter_count(from);
+
+	u64 duration;
+
+	ssize_t ret;
+
+	ret = pcd_bcast_do_write_iter(iocb,from);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_write(MINOR(pcdev_data->dev_num),pos,count,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_WRITE,ret,duration);
+
+	return ret;
+}
+
+static __poll_t pcd_bcast_poll(struct file *filp, poll_table *wait)
+{
+	struct pcd_bcast_reader *reader = filp->private_data;
+
+	struct pcd_bcast *bcast = &reader->pcdev_data->bcast;
+
+	__poll_t mask = 0;
+
+	poll_wait(filp,&bcast->wq,wait);
+
+	if(pcd_bcast_head(bcast) != READ_ONCE(reader->ctrl->data_tail))
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	/* the writer never waits for readers */
+	if(filp->f_mode & FMODE_WRITE)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static vm_fault_t pcd_bcast_vm_fault(struct vm_fault *vmf)
+{
+	struct pcd_bcast_reader *reader = vmf->vma->vm_private_data;
+
+	if(vmf->pgoff == 0)
+		return vmf_insert_pfn(vmf->vma,vmf->address,page_to_pfn(reader->ctrl_page));
+
+	return pcd_fault_buffer_page(reader->pcdev_data,vmf,vmf->pgoff - 1);
+}
+
+static const struct vm_operations_struct pcd_bcast_vm_ops =
+{
+	.fault = pcd_bcast_vm_fault,
+};
+
+/*page 0 is the control page, the ring follows from page 1 */
+static int pcd_bcast_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct pcd_bcast_reader *reader = filp->private_data;
+
+	unsigned long len = vma->vm_end - vma->vm_start;
+
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	if(vma->vm_pgoff == 0){
+		/* the reader stores its tail in the control page */
+		if(len != PAGE_SIZE)
+			return -EINVAL;
+	}else{
+		/* the ring is shared by all readers */
+		if(vma->vm_flags & VM_WRITE)
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+
+		if(((vma->vm_pgoff - 1) << PAGE_SHIFT) + len > PAGE_ALIGN(reader->pcdev_data->pdata.size))
+			return -EINVAL;
+	}
+
+	vma->vm_flags |= VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_ops = &pcd_bcast_vm_ops;
+	vma->vm_private_data = reader;
+
+	return 0;
+}
+
+static int pcd_bcast_release(struct inode *inode, struct file *filp)
+{
+	struct pcd_bcast_reader *reader = filp->private_data;
+
+	struct pcdev_private_data *pcdev_data = reader->pcdev_data;
+
+	spin_lock(&pcdev_data->bcast.lock);
+	list_del(&reader->node);
+	spin_unlock(&pcdev_data->bcast.lock);
+
+	if(filp->f_mode & FMODE_WRITE){
+		mutex_lock(&pcdev_data->mode_lock);
+		pcdev_data->bcast.writer = false;
+		mutex_unlock(&pcdev_data->mode_lock);
+	}
+
+	__free_page(reader->ctrl_page);
+	kfree(reader);
+
+	return pcd_release(inode,filp);
+}
+
+static const struct file_operations pcd_bcast_fops =
+{
+	.release = pcd_bcast_release,
+	.read_iter = pcd_bcast_read_iter,
+	.write_iter = pcd_bcast_write_iter,
+	.poll = pcd_bcast_poll,
+	.mmap = pcd_bcast_mmap,
+	.llseek = no_llseek,
+	.owner = THIS_MODULE
+};
+
+/*called by pcd_open with mode_lock held. Readers start at the current head,
+they only see what is written after they opened the device */
+int pcd_bcast_open(struct file *filp, struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_bcast *bcast = &pcdev_data->bcast;
+
+	const struct file_operations *fops;
+
+	struct pcd_bcast_reader *reader;
+
+	if((filp->f_mode & FMODE_WRITE) && bcast->writer)
+		return -EBUSY;
+
+	reader = kzalloc(sizeof(*reader),GFP_KERNEL);
+	if(!reader)
+		return -ENOMEM;
+
+	reader->ctrl_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if(!reader->ctrl_page){
+		kfree(reader);
+		return -ENOMEM;
+	}
+
+	fops = fops_get(&pcd_bcast_fops);
+	if(!fops){
+		__free_page(reader->ctrl_page);
+		kfree(reader);
+		return -ENODEV;
+	}
+
+	reader->pcdev_data = pcdev_data;
+	reader->ctrl = page_address(reader->ctrl_page);
+	reader->ctrl->data_size = pcdev_data->pdata.size;
+
+	spin_lock(&bcast->lock);
+	reader->ctrl->data_head = bcast->head;
+	reader->ctrl->data_tail = bcast->head;
+	list_add_tail(&reader->node,&bcast->readers);
+	spin_unlock(&bcast->lock);
+
+	if(filp->f_mode & FMODE_WRITE)
+		bcast->writer = true;
+
+	filp->private_data = reader;
+	stream_open(file_inode(filp),filp);
+	replace_fops(filp,fops);
+
+	return 0;
+}
+
+/*called with mode_lock held and the device closed */
+void pcd_bcast_reset(struct pcdev_private_data *pcdev_data)
+{
+	pcdev_data->bcast.head = 0;
+	pcdev_data->bcast.reserve = 0;
+}
@@ -0,0 +1,851 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*on the entries of pages shared with another buffer by pcd_buffer_clone_range */
+#define PCD_PAGE_SHARED		XA_MARK_0
+
+struct pcd_retired_page
+{
+	struct rcu_head rcu;
+	struct page *page;
+};
+
+/*return the page backing page 'index' of the buffer. A hole is filled with a
+zeroed page if 'alloc' is set, else NULL is returned for it. Pages are
+allocated one at a time, so even a buffer of hundreds of MB never needs a
+high order allocation or vmalloc space */
+struct page *pcd_buffer_page(struct pcd_buffer *buf, unsigned long index, bool alloc)
+{
+	struct page *page, *old;
+
+	page = xa_load(&buf->pages,index);
+	if(page || !alloc)
+		return page;
+
+	page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+	if(!page)
+		return NULL;
+
+	/*a writer and an mmap fault may race to fill the same hole */
+	old = xa_cmpxchg(&buf->pages,index,NULL,page,GFP_KERNEL);
+	if(old){
+		__free_page(page);
+		return xa_is_err(old) ? NULL : old;
+	}
+
+	atomic_long_inc(&buf->nr_resident);
+
+	return page;
+}
+
+static void pcd_buffer_put_page_rcu(struct rcu_head *rcu)
+{
+	struct pcd_retired_page *retired = container_of(rcu,struct pcd_retired_page,rcu);
+
+	put_page(retired->page);
+	kfree(retired);
+}
+
+/*Give page 'index' a copy of its own in place of 'page', which is shared.
+Appenders and mmap faults unshare pages while readers of the device may
+still be copying from them, so the reference to the shared page is only
+dropped after an SRCU grace period. Returns ERR_PTR(-EAGAIN) if another
+writer got there first, ERR_PTR(-ENOMEM) if there is no memory for the copy */
+static struct page *pcd_buffer_unshare(struct pcd_buffer *buf, unsigned long index, struct page *page)
+{
+	struct pcd_retired_page *retired;
+	struct page *copy;
+
+	/*the other buffers let go of the page already, it can be written in place */
+	xa_lock(&buf->pages);
+	if(page_ref_count(page) == 1){
+		__xa_clear_mark(&buf->pages,index,PCD_PAGE_SHARED);
+		xa_unlock(&buf->pages);
+		return page;
+	}
+	xa_unlock(&buf->pages);
+
+	retired = kmalloc(sizeof(*retired),GFP_KERNEL);
+	copy = alloc_page(GFP_HIGHUSER);
+	if(!retired || !copy){
+		kfree(retired);
+		if(copy)
+			__free_page(copy);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	copy_highpage(copy,page);
+
+	xa_lock(&buf->pages);
+	if(xa_load(&buf->pages,index) != page || !xa_get_mark(&buf->pages,index,PCD_PAGE_SHARED)){
+		xa_unlock(&buf->pages);
+		kfree(retired);
+		__free_page(copy);
+		return ERR_PTR(-EAGAIN);
+	}
+	/*replacing an entry needs no memory */
+	__xa_store(&buf->pages,index,copy,GFP_ATOMIC);
+	__xa_clear_mark(&buf->pages,index,PCD_PAGE_SHARED);
+	xa_unlock(&buf->pages);
+
+	retired->page = page;
+	call_srcu(buf->srcu,&retired->rcu,pcd_buffer_put_page_rcu);
+
+	return copy;
+}
+
+/*like pcd_buffer_page, for a page which is about to be written. Every write
+to the buffer goes through here, so pages shared with another buffer are
+copied before they change. NULL is only returned for a hole which 'alloc'
+does not fill, a page which cannot be allocated or copied is
+ERR_PTR(-ENOMEM), so callers never take stale shared data for a hole */
+struct page *pcd_buffer_write_page(struct pcd_buffer *buf, unsigned long index, bool alloc)
+{
+	struct page *page;
+
+	do{
+		page = pcd_buffer_page(buf,index,alloc);
+		if(!page)
+			return alloc ? ERR_PTR(-ENOMEM) : NULL;
+		if(!xa_get_mark(&buf->pages,index,PCD_PAGE_SHARED))
+			return page;
+		page = pcd_buffer_unshare(buf,index,page);
+	}while(page == ERR_PTR(-EAGAIN));
+
+	return page;
+}
+
+/*fill the holes among pages [from, to) */
+static int pcd_buffer_fill_pages(struct pcd_buffer *buf, unsigned long from, unsigned long to)
+{
+	unsigned long i;
+
+	for(i = from ; i < to ; i++){
+		if(!pcd_buffer_page(buf,i,true))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static struct pcd_buffer *pcd_buffer_create(int size, bool sparse, struct srcu_struct *srcu)
+{
+	struct pcd_buffer *buf;
+
+	buf = kzalloc(sizeof(*buf),GFP_KERNEL);
+	if(!buf)
+		return NULL;
+
+	buf->size = size;
+	buf->nr_pages = DIV_ROUND_UP(size,PAGE_SIZE);
+	buf->sparse = sparse;
+	buf->srcu = srcu;
+	xa_init(&buf->pages);
+	atomic_long_set(&buf->nr_resident,0);
+
+	return buf;
+}
+
+/*allocate a zeroed buffer of 'size' bytes. A sparse buffer starts out as one
+big hole and only gets pages when they are written */
+struct pcd_buffer *pcd_buffer_alloc(int size, bool sparse, struct srcu_struct *srcu)
+{
+	struct pcd_buffer *buf;
+
+	buf = pcd_buffer_create(size,sparse,srcu);
+	if(!buf)
+		return NULL;
+
+	if(!sparse && pcd_buffer_fill_pages(buf,0,buf->nr_pages)){
+		pcd_buffer_free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+void pcd_buffer_free(struct pcd_buffer *buf)
+{
+	unsigned long index;
+	struct page *page;
+
+	xa_for_each(&buf->pages,index,page)
+		put_page(page);
+
+	xa_destroy(&buf->pages);
+	kfree(buf);
+}
+
+/*copy 'count' bytes at 'pos' to the iterator page by page, returns the number
+of bytes copied which is short if the user buffer faulted. Holes read as
+zeroes without getting a page */
+size_t pcd_buffer_copy_to_iter(struct pcd_buffer *buf, loff_t pos, size_t count, struct iov_iter *to)
+{
+	size_t copied = 0, chunk, n;
+	struct page *page;
+
+	while(copied < count){
+		chunk = min_t(size_t,count - copied,PAGE_SIZE - offset_in_page(pos));
+		page = pcd_buffer_page(buf,pos >> PAGE_SHIFT,false);
+		if(page)
+			n = copy_page_to_iter(page,offset_in_page(pos),chunk,to);
+		else
+			n = iov_iter_zero(chunk,to);
+		copied += n;
+		pos += n;
+		if(n != chunk)
+			break;
+	}
+
+	return copied;
+}
+
+/*copy 'count' bytes from the iterator to 'pos', filling holes on the way.
+Returns the number of bytes copied, or -ENOMEM if not even the first page
+could be allocated */
+ssize_t pcd_buffer_copy_from_iter(struct pcd_buffer *buf, loff_t pos, size_t count, struct iov_iter *from)
+{
+	size_t copied = 0, chunk, n;
+	struct page *page;
+
+	while(copied < count){
+		chunk = min_t(size_t,count - copied,PAGE_SIZE - offset_in_page(pos));
+		page = pcd_buffer_write_page(buf,pos >> PAGE_SHIFT,true);
+		if(IS_ERR(page))
+			return copied ? copied : PTR_ERR(page);
+		n = copy_page_from_iter(page,offset_in_page(pos),chunk,from);
+		copied += n;
+		pos += n;
+		if(n != chunk)
+			break;
+	}
+
+	return copied;
+}
+
+/*clear 'len' bytes at 'pos', holes are left alone since they read as zeroes.
+Fails if a shared page cannot be unshared */
+static int pcd_buffer_zero(struct pcd_buffer *buf, loff_t pos, loff_t len)
+{
+	struct page *page;
+	size_t chunk;
+	void *vaddr;
+
+	while(len > 0){
+		chunk = min_t(loff_t,len,PAGE_SIZE - offset_in_page(pos));
+		page = pcd_buffer_write_page(buf,pos >> PAGE_SHIFT,false);
+		if(IS_ERR(page))
+			return PTR_ERR(page);
+		if(page){
+			vaddr = kmap_atomic(page);
+			memset(vaddr + offset_in_page(pos),0,chunk);
+			kunmap_atomic(vaddr);
+		}
+		pos += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/*Set 'len' bytes at 'pos' to 'pattern', 'plen' bytes long and repeated from
+'pos' on, clamped to the size of the device. An all zero pattern leaves the
+holes of a sparse device alone. Returns the number of bytes set */
+ssize_t pcd_buffer_fill_pattern(struct pcdev_private_data *pcdev_data, loff_t pos, size_t len,
+				const u8 *pattern, size_t plen)
+{
+	struct pcd_buffer *buf;
+	size_t done = 0, chunk, phase = 0, i;
+	struct page *page;
+	void *vaddr, *tmpl = NULL;
+	ssize_t ret = 0;
+	bool zero;
+
+	if(pos < 0 || !plen)
+		return -EINVAL;
+
+	zero = !memchr_inv(pattern,0,plen);
+
+	/*a page of the pattern and one period more, so a chunk starting at any
+	phase of the pattern is a single memcpy */
+	if(plen > 1){
+		tmpl = kmalloc(PAGE_SIZE + plen,GFP_KERNEL);
+		if(!tmpl)
+			return -ENOMEM;
+		for(i = 0 ; i < PAGE_SIZE + plen ; i += plen)
+			memcpy(tmpl + i,pattern,min_t(size_t,plen,PAGE_SIZE + plen - i));
+	}
+
+	down_write(&pcdev_data->rwsem);
+
+	buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->rwsem));
+
+	/*same as a write past the end */
+	if(pos >= buf->size){
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	len = min_t(loff_t,len,buf->size - pos);
+
+	while(done < len){
+		chunk = min_t(size_t,len - done,PAGE_SIZE - offset_in_page(pos));
+		page = pcd_buffer_write_page(buf,pos >> PAGE_SHIFT,!zero);
+		if(IS_ERR(page)){
+			ret = PTR_ERR(page);
+			break;
+		}
+		/*else NULL, a hole of a zero fill */
+		if(page){
+			vaddr = kmap_atomic(page);
+			if(tmpl)
+				memcpy(vaddr + offset_in_page(pos),tmpl + phase,chunk);
+			else
+				memset(vaddr + offset_in_page(pos),pattern[0],chunk);
+			kunmap_atomic(vaddr);
+		}
+		phase = (phase + chunk) % plen;
+		done += chunk;
+		pos += chunk;
+	}
+
+out:
+	up_write(&pcdev_data->rwsem);
+
+	kfree(tmpl);
+
+	if(done)
+		pcd_status_update(pcdev_data,pos - done,done);
+
+	return done ? done : ret;
+}
+
+ssize_t pcd_buffer_fill(struct pcdev_private_data *pcdev_data, loff_t pos, size_t len, int c)
+{
+	u8 byte = c;
+
+	return pcd_buffer_fill_pattern(pcdev_data,pos,len,&byte,1);
+}
+
+/*move 'len' bytes from 'spos' in 'src' to 'dpos' in 'dst' as memmove()
+would, back to front when the ranges overlap that way. Chunks never cross a
+page boundary of either buffer. A hole in the source clears the destination,
+or leaves it alone if it is a hole too */
+static ssize_t pcd_buffer_move(struct pcd_buffer *dst, loff_t dpos,
+				struct pcd_buffer *src, loff_t spos, size_t len)
+{
+	bool backward = (dst == src && dpos > spos && dpos < spos + len);
+	struct page *dpage, *spage;
+	void *dvaddr, *svaddr;
+	size_t done = 0, chunk;
+	loff_t d, s;
+
+	while(done < len){
+		if(backward){
+			d = dpos + len - done;
+			s = spos + len - done;
+			chunk = min3(len - done,(size_t)offset_in_page(d - 1) + 1,
+					(size_t)offset_in_page(s - 1) + 1);
+			d -= chunk;
+			s -= chunk;
+		}else{
+			d = dpos + done;
+			s = spos + done;
+			chunk = min3(len - done,(size_t)(PAGE_SIZE - offset_in_page(d)),
+					(size_t)(PAGE_SIZE - offset_in_page(s)));
+		}
+
+		spage = pcd_buffer_page(src,s >> PAGE_SHIFT,false);
+		dpage = pcd_buffer_write_page(dst,d >> PAGE_SHIFT,spage != NULL);
+		if(IS_ERR(dpage)){
+			/*only a forward move has a clean prefix done */
+			return (done && !backward) ? done : PTR_ERR(dpage);
+		}
+		/*a hole onto a hole */
+		if(!dpage){
+			done += chunk;
+			continue;
+		}
+
+		dvaddr = kmap_atomic(dpage);
+		if(!spage){
+			memset(dvaddr + offset_in_page(d),0,chunk);
+		}else if(spage == dpage){
+			memmove(dvaddr + offset_in_page(d),dvaddr + offset_in_page(s),chunk);
+		}else{
+			svaddr = kmap_atomic(spage);
+			memcpy(dvaddr + offset_in_page(d),svaddr + offset_in_page(s),chunk);
+			kunmap_atomic(svaddr);
+		}
+		kunmap_atomic(dvaddr);
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+/*Copy 'len' bytes at 'spos' of 'src_data' to 'dpos' of 'dst_data', which may
+be the same device. The range is clamped to the size of both devices, and a
+destination past the end fails like a write would. Returns the number of
+bytes copied */
+ssize_t pcd_buffer_copy_range(struct pcdev_private_data *dst_data, loff_t dpos,
+				struct pcdev_private_data *src_data, loff_t spos, size_t len)
+{
+	struct pcd_buffer *dst, *src;
+	ssize_t ret = 0;
+	int idx;
+
+	if(dpos < 0 || spos < 0)
+		return -EINVAL;
+
+	/*two devices are locked in address order, so copies going both ways
+	between them cannot deadlock */
+	if(src_data == dst_data){
+		down_write(&dst_data->rwsem);
+	}else if(src_data < dst_data){
+		down_read(&src_data->rwsem);
+		down_write_nested(&dst_data->rwsem,SINGLE_DEPTH_NESTING);
+	}else{
+		down_write(&dst_data->rwsem);
+		down_read_nested(&src_data->rwsem,SINGLE_DEPTH_NESTING);
+	}
+
+	/*a shared hold of rwsem does not keep a resize out, the source is
+	picked up the way a reader does */
+	idx = srcu_read_lock(&src_data->srcu);
+	src = srcu_dereference(src_data->buffer,&src_data->srcu);
+	dst = rcu_dereference_protected(dst_data->buffer,
+				lockdep_is_held(&dst_data->rwsem));
+
+	if(dpos >= dst->size){
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if(spos >= src->size)
+		goto out;
+
+	len = min_t(loff_t,len,dst->size - dpos);
+	len = min_t(loff_t,len,src->size - spos);
+
+	ret = pcd_buffer_move(dst,dpos,src,spos,len);
+
+out:
+	srcu_read_unlock(&src_data->srcu,idx);
+	if(src_data != dst_data)
+		up_read(&src_data->rwsem);
+	up_write(&dst_data->rwsem);
+
+	if(ret > 0)
+		pcd_status_update(dst_data,dpos,ret);
+
+	return ret;
+}
+
+/*Make the 'len' bytes at 'dpos' of 'dst_data' share the pages at 'spos' of
+'src_data' instead of copying them. Both offsets must be page aligned, a
+partial page at the end of the range is copied. Shared pages are marked in
+both buffers and copied by the first write to either of them, see
+pcd_buffer_write_page(). Returns the number of bytes cloned */
+ssize_t pcd_buffer_clone_range(struct pcdev_private_data *dst_data, loff_t dpos,
+				struct pcdev_private_data *src_data, loff_t spos, size_t len)
+{
+	struct pcd_buffer *dst, *src;
+	unsigned long i, nr, sidx, didx;
+	struct page *page, *old;
+	size_t done;
+	ssize_t ret = 0, n;
+
+	if(dpos < 0 || spos < 0 || offset_in_page(dpos) || offset_in_page(spos))
+		return -EINVAL;
+
+	/*the pages of the destination are replaced and those of the source
+	become shared, neither may happen under appenders since they write
+	without rwsem: one which looked up a source page before it was marked
+	would write into the destination too. resize_lock keeps mmap faults out
+	until the ptes of both ranges are gone. Two devices are locked in address
+	order, like in pcd_buffer_copy_range */
+	if(src_data == dst_data){
+		percpu_down_write(&dst_data->append_sem);
+	}else if(src_data < dst_data){
+		percpu_down_write(&src_data->append_sem);
+		percpu_down_write(&dst_data->append_sem);
+	}else{
+		percpu_down_write(&dst_data->append_sem);
+		percpu_down_write(&src_data->append_sem);
+	}
+
+	if(src_data == dst_data){
+		down_write(&dst_data->rwsem);
+		mutex_lock(&dst_data->resize_lock);
+	}else if(src_data < dst_data){
+		down_read(&src_data->rwsem);
+		down_write_nested(&dst_data->rwsem,SINGLE_DEPTH_NESTING);
+		mutex_lock(&src_data->resize_lock);
+		mutex_lock_nested(&dst_data->resize_lock,SINGLE_DEPTH_NESTING);
+	}else{
+		down_write(&dst_data->rwsem);
+		down_read_nested(&src_data->rwsem,SINGLE_DEPTH_NESTING);
+		mutex_lock(&dst_data->resize_lock);
+		mutex_lock_nested(&src_data->resize_lock,SINGLE_DEPTH_NESTING);
+	}
+
+	src = rcu_dereference_protected(src_data->buffer,
+				lockdep_is_held(&src_data->resize_lock));
+	dst = rcu_dereference_protected(dst_data->buffer,
+				lockdep_is_held(&dst_data->resize_lock));
+
+	if(dpos >= dst->size){
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if(spos >= src->size)
+		goto out;
+
+	len = min_t(loff_t,len,dst->size - dpos);
+	len = min_t(loff_t,len,src->size - spos);
+
+	if(!len)
+		goto out;
+
+	if(src == dst && dpos < spos + len && spos < dpos + len){
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/*no pte may be left to a page the destination gives up, and the source
+	must fault before a shared page is written. Faults wait for resize_lock */
+	unmap_mapping_range(&dst_data->mapping,dpos,len,1);
+	unmap_mapping_range(&src_data->mapping,spos,len,1);
+
+	nr = len >> PAGE_SHIFT;
+	sidx = spos >> PAGE_SHIFT;
+	didx = dpos >> PAGE_SHIFT;
+
+	for(i = 0 ; i < nr ; i++){
+		page = xa_load(&src->pages,sidx + i);
+		if(!page){
+			/*a hole stays a hole where the device can have them */
+			if(!dst->sparse){
+				ret = pcd_buffer_zero(dst,(loff_t)(didx + i) << PAGE_SHIFT,PAGE_SIZE);
+				if(ret)
+					break;
+				continue;
+			}
+			old = xa_erase(&dst->pages,didx + i);
+			if(old){
+				put_page(old);
+				atomic_long_dec(&dst->nr_resident);
+			}
+			continue;
+		}
+
+		get_page(page);
+		old = xa_store(&dst->pages,didx + i,page,GFP_KERNEL);
+		if(xa_is_err(old)){
+			put_page(page);
+			ret = xa_err(old);
+			break;
+		}
+		xa_set_mark(&src->pages,sidx + i,PCD_PAGE_SHARED);
+		xa_set_mark(&dst->pages,didx + i,PCD_PAGE_SHARED);
+
+		/*no reader of the destination is left to use the old page */
+		if(old)
+			put_page(old);
+		else
+			atomic_long_inc(&dst->nr_resident);
+	}
+
+	done = (size_t)i << PAGE_SHIFT;
+	if(i == nr && done < len){
+		n = pcd_buffer_move(dst,dpos + done,src,spos + done,len - done);
+		if(n > 0)
+			done += n;
+		else
+			ret = n;
+	}
+
+	if(done)
+		ret = done;
+
+out:
+	if(src_data == dst_data){
+		mutex_unlock(&dst_data->resize_lock);
+		up_write(&dst_data->rwsem);
+	}else{
+		mutex_unlock(&src_data->resize_lock);
+		mutex_unlock(&dst_data->resize_lock);
+		up_read(&src_data->rwsem);
+		up_write(&dst_data->rwsem);
+		percpu_up_write(&src_data->append_sem);
+	}
+	percpu_up_write(&dst_data->append_sem);
+
+	if(ret > 0)
+		pcd_status_update(dst_data,dpos,ret);
+
+	return ret;
+}
+
+static const void *pcd_memmem(const void *haystack, size_t len, const u8 *pattern, size_t plen)
+{
+	const void *p = haystack, *end = haystack + len;
+
+	while((size_t)(end - p) >= plen){
+		p = memchr(p,pattern[0],end - p - plen + 1);
+		if(!p)
+			return NULL;
+		if(!memcmp(p,pattern,plen))
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*Return the offset of the first match of 'pattern', 'plen' bytes long, in
+the 'len' bytes at 'pos', or to the end of the device if 'len' is 0. Pages
+are searched where they are, holes as the zero page. A match across a page
+boundary is found in a small window made of the end of one page and the
+start of the next. Returns -ENOENT if there is no match */
+loff_t pcd_buffer_search(struct pcdev_private_data *pcdev_data, loff_t pos, loff_t len,
+				const u8 *pattern, size_t plen)
+{
+	u8 edge[2 * (PCD_PATTERN_MAX - 1)];
+	size_t carry = 0, chunk, n;
+	struct pcd_buffer *buf;
+	const void *match;
+	struct page *page;
+	loff_t end, ret;
+	void *vaddr;
+	int idx;
+
+	if(pos < 0 || len < 0 || !plen || plen > PCD_PATTERN_MAX)
+		return -EINVAL;
+
+	down_read(&pcdev_data->rwsem);
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	ret = -ENOENT;
+
+	end = buf->size;
+	if(pos < end && len && len < end - pos)
+		end = pos + len;
+
+	while(pos < end){
+		chunk = min_t(loff_t,end - pos,PAGE_SIZE - offset_in_page(pos));
+		page = pcd_buffer_page(buf,pos >> PAGE_SHIFT,false);
+		vaddr = kmap_atomic(page ? page : ZERO_PAGE(0));
+		vaddr += offset_in_page(pos);
+
+		/*matches starting in the tail of the previous chunk */
+		if(carry){
+			n = min(chunk,plen - 1);
+			memcpy(edge + carry,vaddr,n);
+			match = pcd_memmem(edge,carry + n,pattern,plen);
+			if(match){
+				kunmap_atomic(vaddr);
+				ret = pos - carry + (match - (void *)edge);
+				break;
+			}
+		}
+
+		match = pcd_memmem(vaddr,chunk,pattern,plen);
+		if(match){
+			kunmap_atomic(vaddr);
+			ret = pos + (match - vaddr);
+			break;
+		}
+
+		/*only the last chunk can be shorter than the pattern while there
+		is a carry, so the carry is always taken from this chunk alone */
+		carry = min(chunk,plen - 1);
+		memcpy(edge,vaddr + chunk - carry,carry);
+
+		kunmap_atomic(vaddr);
+		pos += chunk;
+	}
+
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	up_read(&pcdev_data->rwsem);
+
+	return ret;
+}
+
+/*Release the pages of a sparse device which lie completely inside
+[offset, offset + len) and zero the partial pages at both ends. The range
+reads as zeroes afterwards, and the pages are only allocated again when
+they are written. */
+int pcd_buffer_punch_hole(struct pcdev_private_data *pcdev_data, loff_t offset, loff_t len)
+{
+	struct pcd_buffer *buf;
+	unsigned long first, last, i;
+	struct page *page;
+	loff_t end;
+	int ret = 0;
+
+	if(offset < 0 || len <= 0)
+		return -EINVAL;
+
+	/*rwsem keeps readers and writers out, append_sem appenders, and
+	resize_lock keeps mmap faults from filling the hole again before it is
+	complete */
+	percpu_down_write(&pcdev_data->append_sem);
+	down_write(&pcdev_data->rwsem);
+	mutex_lock(&pcdev_data->resize_lock);
+
+	buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->resize_lock));
+
+	if(!buf->sparse){
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if(offset >= buf->size)
+		goto out;
+
+	end = min_t(loff_t,offset + len,buf->size);
+
+	/*whole pages in the range, the last page also counts as whole if the
+	range runs to the end of the device */
+	first = DIV_ROUND_UP(offset,PAGE_SIZE);
+	last = (end == buf->size) ? buf->nr_pages : end >> PAGE_SHIFT;
+
+	if(first >= last){
+		ret = pcd_buffer_zero(buf,offset,end - offset);
+		goto out;
+	}
+
+	ret = pcd_buffer_zero(buf,offset,((loff_t)first << PAGE_SHIFT) - offset);
+	if(!ret)
+		ret = pcd_buffer_zero(buf,(loff_t)last << PAGE_SHIFT,end - ((loff_t)last << PAGE_SHIFT));
+	if(ret)
+		goto out;
+
+	unmap_mapping_range(&pcdev_data->mapping,(loff_t)first << PAGE_SHIFT,
+			(loff_t)(last - first) << PAGE_SHIFT,1);
+
+	for(i = first ; i < last ; i++){
+		page = xa_erase(&buf->pages,i);
+		if(page){
+			put_page(page);
+			atomic_long_dec(&buf->nr_resident);
+		}
+	}
+
+out:
+	mutex_unlock(&pcdev_data->resize_lock);
+	up_write(&pcdev_data->rwsem);
+	percpu_up_write(&pcdev_data->append_sem);
+
+	if(!ret && offset < pcdev_data->pdata.size)
+		pcd_status_update(pcdev_data,offset,min_t(loff_t,len,pcdev_data->pdata.size - offset));
+
+	return ret;
+}
+
+/*Replace the buffer of the device by one of 'size' bytes, keeping the
+contents that still fit.
+
+The new buffer is built off to the side and published with
+rcu_assign_pointer(), so readers are never stalled: they keep copying from
+the buffer they picked up until they leave their SRCU read section. Only
+writers are held off, through a shared hold of rwsem, while the new buffer
+takes over the old pages. A failed allocation leaves the device untouched. */
+int pcd_buffer_resize(struct pcdev_private_data *pcdev_data, int size)
+{
+	struct pcd_buffer *new_buf, *old_buf;
+	unsigned long index;
+	struct page *page;
+	int old_size, tail;
+	void *vaddr;
+	int ret;
+
+	/*rwsem before resize_lock, the same order as a read or write which
+	faults on an mmap of the device while it holds rwsem. Appenders only
+	hold append_sem, so they are kept out for the whole resize */
+	percpu_down_write(&pcdev_data->append_sem);
+	down_read(&pcdev_data->rwsem);
+
+	mutex_lock(&pcdev_data->resize_lock);
+
+	old_buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->resize_lock));
+
+	new_buf = pcd_buffer_create(size,old_buf->sparse,old_buf->srcu);
+	if(!new_buf){
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	/*the pages both sizes have in common are shared instead of copied, the
+	old buffer only drops its references once its last reader is gone */
+	xa_for_each(&old_buf->pages,index,page){
+		if(index >= new_buf->nr_pages)
+			break;
+		ret = xa_err(xa_store(&new_buf->pages,index,page,GFP_KERNEL));
+		if(ret)
+			goto free_new;
+		if(xa_get_mark(&old_buf->pages,index,PCD_PAGE_SHARED))
+			xa_set_mark(&new_buf->pages,index,PCD_PAGE_SHARED);
+		get_page(page);
+		atomic_long_inc(&new_buf->nr_resident);
+	}
+
+	if(!new_buf->sparse){
+		ret = pcd_buffer_fill_pages(new_buf,0,new_buf->nr_pages);
+		if(ret)
+			goto free_new;
+	}
+
+	/*bytes beyond the old size in its last page may hold data from before an
+	earlier shrink, clear them when growing */
+	old_size = old_buf->size;
+	tail = min_t(int,size,PAGE_ALIGN(old_size)) - old_size;
+	if(tail > 0){
+		page = pcd_buffer_write_page(new_buf,old_size >> PAGE_SHIFT,false);
+		if(IS_ERR(page)){
+			ret = PTR_ERR(page);
+			goto free_new;
+		}
+		if(page){
+			vaddr = kmap_atomic(page);
+			memset(vaddr + offset_in_page(old_size),0,tail);
+			kunmap_atomic(vaddr);
+		}
+	}
+
+	/*drop the ptes of existing mmaps, pages beyond the new size go away with
+	the old buffer. pcd_vm_fault runs under resize_lock, so the next access
+	waits for the swap and then faults in the new buffer */
+	unmap_mapping_range(&pcdev_data->mapping,0,0,1);
+
+	rcu_assign_pointer(pcdev_data->buffer,new_buf);
+	pcdev_data->pdata.size = size;
+
+	mutex_unlock(&pcdev_data->resize_lock);
+
+	up_read(&pcdev_data->rwsem);
+	percpu_up_write(&pcdev_data->append_sem);
+
+	/*wait for the readers still copying from the old buffer */
+	synchronize_srcu(&pcdev_data->srcu);
+	pcd_buffer_free(old_buf);
+
+	return 0;
+
+free_new:
+	pcd_buffer_free(new_buf);
+unlock:
+	mutex_unlock(&pcdev_data->resize_lock);
+	up_read(&pcdev_data->rwsem);
+	percpu_up_write(&pcdev_data->append_sem);
+	return ret;
+}
@@ -0,0 +1,285 @@
+#ifndef PCD_IOCTL_H
+#define PCD_IOCTL_H
+
+/* ioctl interface of the pcdevs, shared with user space */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define PCD_IOC_MAGIC 'p'
+
+/*byte range of a pcdev */
+struct pcd_range
+{
+	__u64 offset;
+	__u64 len;
+};
+
+/*release the pages of a sparse pcdev in the range, it reads as zeroes after */
+#define PCD_IOC_PUNCH_HOLE	_IOW(PCD_IOC_MAGIC, 1, struct pcd_range)
+
+#define PCD_IO_READ	0
+#define PCD_IO_WRITE	1
+
+/*one access of a batch, 'result' is filled in with the number of bytes
+transferred or a negative errno */
+struct pcd_io_desc
+{
+	__u32 op;
+	__u32 reserved;
+	__u64 offset;
+	__u64 len;
+	__u64 buf;
+	__s64 result;
+};
+
+struct pcd_io_batch
+{
+	__u64 descs;	/* user pointer to an array of struct pcd_io_desc */
+	__u32 count;
+	__u32 reserved;
+};
+
+#define PCD_IO_BATCH_MAX	256
+
+/*run all the accesses of a batch in one call, in array order */
+#define PCD_IOC_BATCH		_IOW(PCD_IOC_MAGIC, 2, struct pcd_io_batch)
+
+/*
+ * Submission/completion rings. PCD_IOC_RING_SETUP on any pcdev returns a new
+ * ring fd. Mapping 'size' bytes of the ring fd at offset 0 gives a
+ * struct pcd_ring_hdr, the submission queue at 'sq_off' and the completion
+ * queue at 'cq_off'. User space fills submission entries and moves sq_tail,
+ * then rings the doorbell with PCD_IOC_RING_ENTER on the ring fd. The kernel
+ * runs the entries, posts their results on the completion queue and signals
+ * the eventfd given at setup.
+ */
+#define PCD_RING_MAX_ENTRIES	4096
+
+#define PCD_OP_READ	0
+#define PCD_OP_WRITE	1
+#define PCD_OP_FILL	2
+
+struct pcd_sqe
+{
+	__u8 op;
+	__u8 fill;	/* byte value of PCD_OP_FILL */
+	__u16 reserved;
+	__s32 fd;	/* any open pcdev */
+	__u64 offset;
+	__u64 len;
+	__u64 addr;	/* user buffer of PCD_OP_READ and PCD_OP_WRITE */
+	__u64 user_data;	/* copied to the completion */
+};
+
+struct pcd_cqe
+{
+	__u64 user_data;
+	__s64 res;	/* bytes transferred or a negative errno */
+};
+
+/*the kernel moves sq_head and cq_tail, user space sq_tail and cq_head */
+struct pcd_ring_hdr
+{
+	__u32 sq_head;
+	__u32 sq_tail;
+	__u32 sq_mask;
+	__u32 sq_entries;
+	__u32 cq_head;
+	__u32 cq_tail;
+	__u32 cq_mask;
+	__u32 cq_entries;
+};
+
+struct pcd_ring_params
+{
+	__u32 sq_entries;	/* rounded up to a power of two */
+	__u32 cq_entries;	/* twice sq_entries if 0 */
+	__s32 eventfd;		/* -1 for no notification */
+	__u32 reserved;
+	/* filled in by the kernel */
+	__u64 sq_off;
+	__u64 cq_off;
+	__u64 size;
+};
+
+#define PCD_IOC_RING_SETUP	_IOWR(PCD_IOC_MAGIC, 3, struct pcd_ring_params)
+/*run at most 'arg' pending submissions, returns how many were consumed */
+#define PCD_IOC_RING_ENTER	_IO(PCD_IOC_MAGIC, 4)
+
+/*
+ * Broadcast mode, selected by writing "broadcast" to the mode attribute of a
+ * closed pcdev. Writes append to a ring over the whole device, every open file
+ * reads what was written after it was opened, at its own pace.
+ *
+ * Page 0 of an mmap is the control page of the open file, the ring data
+ * follows from page 1 and can only be mapped read-only. data_head and
+ * data_tail are free running byte counts, the data lives at
+ * (position % data_size). Read data_head, then the data, then store the new
+ * data_tail. If data_head - data_tail exceeds data_size the writer has
+ * overwritten data which was not consumed yet.
+ */
+struct pcd_bcast_ctrl
+{
+	__u64 data_head;	/* written by the kernel */
+	__u64 data_size;
+	__u64 lost;		/* bytes overwritten before they were consumed */
+	__u64 reserved;
+	__u64 data_tail;	/* written by the reader */
+};
+
+/*
+ * Append mode, selected by writing "append" to the mode attribute of a closed
+ * pcdev. Every write becomes one record, a header followed by the data, padded
+ * to PCD_LOG_ALIGN. Writers reserve their record with a compare-and-exchange
+ * on the tail of the log and never wait for each other, so the log is in
+ * reservation order while records may be committed out of order. A record
+ * which does not fit fails with ENOSPC and takes no space. A reader walks the
+ * log from offset 0 and stops at the first header without PCD_LOG_COMMITTED.
+ * Switching to append mode clears the log.
+ */
+#define PCD_LOG_ALIGN		8
+
+#define PCD_LOG_COMMITTED	0x1	/* len and data are valid */
+#define PCD_LOG_DISCARD		0x2	/* the writer faulted, skip the record */
+
+struct pcd_log_hdr
+{
+	__u32 len;	/* bytes of data after the header */
+	__u32 flags;
+};
+
+/*
+ * Sharded mode, selected by writing "sharded" to the mode attribute of a
+ * closed pcdev. Every CPU writes into a ring of its own, each write becomes
+ * one record. read() consumes records from all rings merged by timestamp, as
+ * a header followed by the data, padded to PCD_LOG_ALIGN. seq counts the
+ * writes of one CPU, a gap means the ring of that CPU was full and records
+ * were dropped.
+ */
+struct pcd_shard_rec
+{
+	__u64 ts_ns;	/* CLOCK_MONOTONIC */
+	__u32 seq;
+	__u16 cpu;
+	__u16 len;	/* bytes of data after the header */
+};
+
+/*
+ * Record mode, selected by writing "record" to the mode attribute of a closed
+ * pcdev. Every write becomes one record, the oldest records are dropped when
+ * the device is full. The file position is a sequence number: read() returns
+ * the record at the position and as many following ones as fit, each as a
+ * header followed by the data, padded to PCD_LOG_ALIGN. lseek() moves by
+ * records, SEEK_END is the next record to be written. A reader whose record
+ * was dropped gets EPIPE and continues with the oldest one.
+ */
+struct pcd_rec_hdr
+{
+	__u64 ts_ns;	/* CLOCK_MONOTONIC */
+	__u64 seq;
+	__u32 pid;	/* thread group id of the writer */
+	__u32 len;	/* bytes of data after the header */
+};
+
+/*
+ * Change status of a pcdev, in its sysfs attribute 'status' which can be
+ * read or mmap()ed read-only. generation goes up by two on every write, in
+ * any mode, every key-value PUT and DELETE, hole punch and resize, and is odd
+ * while the other fields are being updated. In broadcast and record mode
+ * last_offset is the free running position of the write in the ring, in
+ * sharded mode, whose rings are not part of the buffer, the range is empty.
+ * poll() on the attribute returns after it changes, updates close together
+ * wake pollers once.
+ */
+struct pcd_status
+{
+	__u32 generation;
+	__u32 reserved;
+	__u64 last_offset;	/* range of the last change */
+	__u64 last_len;
+	__u64 size;		/* max_size of the device */
+};
+
+/*
+ * Key-value mode, selected by writing "kv" to the mode attribute of a closed
+ * pcdev, which then starts out empty. The device is only accessed through the
+ * ioctls below, read() still returns the raw log.
+ *
+ * GET copies the value of 'key' to 'value'. PUT stores 'value_len' bytes at
+ * 'value' under 'key', replacing any old value. DELETE removes 'key'. GET and
+ * ITERATE set value_len (and ITERATE key_len) to the sizes of the entry, and
+ * fail with ERANGE if the buffers given are too small. ITERATE returns the
+ * entry at or after 'cookie', which starts at 0, and moves the cookie past
+ * it. ENOENT means no such key, or the end of the iteration.
+ */
+#define PCD_KV_MAX_KEY		256
+
+struct pcd_kv_req
+{
+	__u64 key;
+	__u64 value;
+	__u32 key_len;
+	__u32 value_len;
+	__u64 cookie;
+};
+
+#define PCD_IOC_KV_GET		_IOWR(PCD_IOC_MAGIC, 5, struct pcd_kv_req)
+#define PCD_IOC_KV_PUT		_IOW(PCD_IOC_MAGIC, 6, struct pcd_kv_req)
+#define PCD_IOC_KV_DELETE	_IOW(PCD_IOC_MAGIC, 7, struct pcd_kv_req)
+#define PCD_IOC_KV_ITERATE	_IOWR(PCD_IOC_MAGIC, 8, struct pcd_kv_req)
+
+/*
+ * Operations run on the data of a pcdev in the kernel, the bytes never go
+ * through user space. FILL repeats the first 'pattern_len' bytes of
+ * 'pattern' over 'len' bytes at 'offset'. COPY moves 'len' bytes from
+ * 'src_off' to 'dst_off' as memmove() would, from the pcdev open as 'src_fd',
+ * or from the same pcdev if it is -1. Both return the number of bytes
+ * written, and only work on pcdevs in normal mode. SEARCH sets 'result' to
+ * the offset of the first match of the pattern in the 'len' bytes at
+ * 'start', 0 meaning up to the end, and fails with ENOENT if there is none.
+ */
+#define PCD_PATTERN_MAX		64
+
+struct pcd_fill_req
+{
+	__u64 offset;
+	__u64 len;
+	__u32 pattern_len;
+	__u32 reserved;
+	__u8 pattern[PCD_PATTERN_MAX];
+};
+
+struct pcd_copy_req
+{
+	__u64 src_off;
+	__u64 dst_off;
+	__u64 len;
+	__s32 src_fd;
+	__u32 reserved;
+};
+
+struct pcd_search_req
+{
+	__u64 start;
+	__u64 len;
+	__u64 result;
+	__u32 pattern_len;
+	__u32 reserved;
+	__u8 pattern[PCD_PATTERN_MAX];
+};
+
+#define PCD_IOC_FILL		_IOW(PCD_IOC_MAGIC, 9, struct pcd_fill_req)
+#define PCD_IOC_COPY		_IOW(PCD_IOC_MAGIC, 10, struct pcd_copy_req)
+#define PCD_IOC_SEARCH		_IOWR(PCD_IOC_MAGIC, 11, struct pcd_search_req)
+
+/*
+ * CLONE takes a pcd_copy_req like COPY, but shares the pages of the source
+ * range with the destination instead of copying them, until either side
+ * writes to them. Both offsets must be page aligned, a partial page at the
+ * end of the range is copied. The VFS only passes copy_file_range(2) and
+ * FICLONERANGE on for regular files, so this is the way in for pcdevs.
+ */
+#define PCD_IOC_CLONE		_IOW(PCD_IOC_MAGIC, 12, struct pcd_copy_req)
+
+#endif
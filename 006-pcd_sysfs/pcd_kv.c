@@ -0,0 +1,475 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Key-value mode. The buffer of the device holds a log of entries, a header
+followed by the key and the value. A PUT appends a new entry and marks the
+one it replaces dead, a DELETE only marks it dead, and when the log reaches
+the end of the device the live entries are compacted to its start.
+
+The index is an open addressing hash table of cache line sized buckets,
+probed bucket by bucket. A slot holds the hash of the key and the position
+of its entry, so a lookup only reads keys from the buffer whose hash
+matches. The index is not kept across a resize, the next request rebuilds it
+from the log */
+
+#define PCD_KV_LIVE	0x4b56
+#define PCD_KV_DEAD	0x4b44
+
+/*slot positions are entry offset + 1 */
+#define PCD_KV_EMPTY	0
+#define PCD_KV_TOMB	U32_MAX
+
+struct pcd_kv_hdr
+{
+	u16 magic;
+	u16 klen;
+	u32 vlen;
+};
+
+#define PCD_KV_LEN(klen,vlen)	ALIGN(sizeof(struct pcd_kv_hdr) + (klen) + (vlen),8)
+
+static void pcd_kv_read(struct pcd_buffer *buf, u32 pos, void *dst, size_t len)
+{
+	struct kvec kv = { .iov_base = dst, .iov_len = len };
+	struct iov_iter iter;
+
+	iov_iter_kvec(&iter,READ,&kv,1,len);
+	pcd_buffer_copy_to_iter(buf,pos,len,&iter);
+}
+
+static int pcd_kv_write(struct pcd_buffer *buf, u32 pos, const void *src, size_t len)
+{
+	struct kvec kv = { .iov_base = (void *)src, .iov_len = len };
+	struct iov_iter iter;
+	ssize_t ret;
+
+	iov_iter_kvec(&iter,WRITE,&kv,1,len);
+	ret = pcd_buffer_copy_from_iter(buf,pos,len,&iter);
+
+	return (ret == len) ? 0 : -ENOMEM;
+}
+
+static void pcd_kv_set_magic(struct pcd_buffer *buf, u32 pos, u16 magic)
+{
+	pcd_kv_write(buf,pos + offsetof(struct pcd_kv_hdr,magic),&magic,sizeof(magic));
+}
+
+static void pcd_kv_changed(struct pcd_kv *kv, u32 pos, u32 len)
+{
+	pcd_status_update(container_of(kv,struct pcdev_private_data,kv),pos,len);
+}
+
+static u32 pcd_kv_hash(const void *key, u16 klen)
+{
+	return jhash(key,klen,0);
+}
+
+/*Slot of 'key'. Without it, NULL, or with 'insert' the first free slot on its
+probe sequence, NULL if the index is full. The key is compared through
+kv->scratch, which must not hold it */
+static struct pcd_kv_slot *pcd_kv_find(struct pcd_kv *kv, struct pcd_buffer *buf,
+				const void *key, u16 klen, u32 hash, bool insert)
+{
+	unsigned long mask = kv->nr_buckets - 1;
+	struct pcd_kv_slot *slot, *free = NULL;
+	struct pcd_kv_hdr hdr;
+	unsigned long b, n;
+	int i;
+
+	for(n = 0, b = hash & mask ; n < kv->nr_buckets ; n++, b = (b + 1) & mask){
+		for(i = 0 ; i < PCD_KV_SLOTS ; i++){
+			slot = &kv->buckets[b].slot[i];
+			if(slot->pos == PCD_KV_EMPTY)
+				return insert ? (free ? free : slot) : NULL;
+			if(slot->pos == PCD_KV_TOMB){
+				if(!free)
+					free = slot;
+				continue;
+			}
+			if(slot->hash != hash)
+				continue;
+			pcd_kv_read(buf,slot->pos - 1,&hdr,sizeof(hdr));
+			if(hdr.klen != klen)
+				continue;
+			pcd_kv_read(buf,slot->pos - 1 + sizeof(hdr),kv->scratch,klen);
+			if(!memcmp(kv->scratch,key,klen))
+				return slot;
+		}
+	}
+
+	return insert ? free : NULL;
+}
+
+static bool pcd_kv_slot_used(struct pcd_kv_slot *slot)
+{
+	return slot->pos != PCD_KV_EMPTY && slot->pos != PCD_KV_TOMB;
+}
+
+/*Length of the entry at 'pos' if it ends by 'end', else 0. The log is read
+back from buffer pages user space may have rewritten, so its lengths are
+checked before they size a copy */
+static u32 pcd_kv_entry_len(const struct pcd_kv_hdr *hdr, u32 pos, u32 end)
+{
+	u32 len;
+
+	if(pos > end || hdr->vlen > end)
+		return 0;
+
+	len = PCD_KV_LEN(hdr->klen,hdr->vlen);
+	if(len > end - pos)
+		return 0;
+
+	return len;
+}
+
+static bool pcd_kv_klen_ok(const struct pcd_kv_hdr *hdr)
+{
+	return hdr->klen && hdr->klen <= PCD_KV_MAX_KEY;
+}
+
+/*Index every live entry of the log, which ends at the first position
+without an entry header, at an entry which no longer fits the device or at
+one with a key no request could have stored */
+static int pcd_kv_rebuild(struct pcd_kv *kv, struct pcd_buffer *buf)
+{
+	void *key = kv->scratch + PCD_KV_MAX_KEY;
+	struct pcd_kv_slot *slot;
+	struct pcd_kv_hdr hdr;
+	u32 pos = 0, len, hash;
+
+	kvfree(kv->buckets);
+	kv->nr_buckets = roundup_pow_of_two(max(buf->size / 256,1));
+	kv->buckets = kvcalloc(kv->nr_buckets,sizeof(*kv->buckets),GFP_KERNEL);
+	if(!kv->buckets)
+		return -ENOMEM;
+
+	while(pos + sizeof(hdr) <= buf->size){
+		pcd_kv_read(buf,pos,&hdr,sizeof(hdr));
+		if(hdr.magic != PCD_KV_LIVE && hdr.magic != PCD_KV_DEAD)
+			break;
+		if(!pcd_kv_klen_ok(&hdr))
+			break;
+		len = pcd_kv_entry_len(&hdr,pos,buf->size);
+		if(!len)
+			break;
+
+		if(hdr.magic == PCD_KV_LIVE){
+			pcd_kv_read(buf,pos + sizeof(hdr),key,hdr.klen);
+			hash = pcd_kv_hash(key,hdr.klen);
+			slot = pcd_kv_find(kv,buf,key,hdr.klen,hash,true);
+			if(!slot){
+				kvfree(kv->buckets);
+				kv->buckets = NULL;
+				return -ENOSPC;
+			}
+			slot->hash = hash;
+			slot->pos = pos + 1;
+		}
+
+		pos += len;
+	}
+
+	kv->tail = pos;
+
+	return 0;
+}
+
+/*move the live entries to the start of the log and clear the rest, an entry
+with a bad key length is dropped and one running past the tail ends the log */
+static int pcd_kv_compact(struct pcd_kv *kv, struct pcd_buffer *buf)
+{
+	struct pcd_kv_hdr hdr;
+	u32 pos = 0, out = 0, len;
+	void *tmp;
+	int ret;
+
+	tmp = kvzalloc(kv->tail,GFP_KERNEL);
+	if(!tmp)
+		return -ENOMEM;
+
+	while(pos + sizeof(hdr) <= kv->tail){
+		pcd_kv_read(buf,pos,&hdr,sizeof(hdr));
+		len = pcd_kv_entry_len(&hdr,pos,kv->tail);
+		if(!len)
+			break;
+		if(hdr.magic == PCD_KV_LIVE && pcd_kv_klen_ok(&hdr)){
+			pcd_kv_read(buf,pos,tmp + out,len);
+			out += len;
+		}
+		pos += len;
+	}
+
+	ret = pcd_kv_write(buf,0,tmp,kv->tail);
+	kvfree(tmp);
+	if(ret)
+		return ret;
+
+	return pcd_kv_rebuild(kv,buf);
+}
+
+static int pcd_kv_get(struct pcd_kv *kv, struct pcd_buffer *buf, struct pcd_kv_req *req, const void *key)
+{
+	struct pcd_kv_slot *slot;
+	struct pcd_kv_hdr hdr;
+	struct iovec iov;
+	struct iov_iter iter;
+	int ret;
+
+	slot = pcd_kv_find(kv,buf,key,req->key_len,pcd_kv_hash(key,req->key_len),false);
+	if(!slot)
+		return -ENOENT;
+
+	pcd_kv_read(buf,slot->pos - 1,&hdr,sizeof(hdr));
+
+	/*like getxattr, a short buffer learns the size it needs */
+	if(req->value_len < hdr.vlen){
+		req->value_len = hdr.vlen;
+		return -ERANGE;
+	}
+	req->value_len = hdr.vlen;
+
+	/*only the value is copied, straight from the buffer pages */
+	ret = import_single_range(READ,u64_to_user_ptr(req->value),hdr.vlen,&iov,&iter);
+	if(ret)
+		return ret;
+
+	if(pcd_buffer_copy_to_iter(buf,slot->pos - 1 + sizeof(hdr) + hdr.klen,hdr.vlen,&iter) != hdr.vlen)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int pcd_kv_put(struct pcd_kv *kv, struct pcd_buffer *buf, struct pcd_kv_req *req, const void *key)
+{
+	u32 len = PCD_KV_LEN(req->key_len,req->value_len);
+	u32 hash = pcd_kv_hash(key,req->key_len);
+	struct pcd_kv_slot *slot;
+	struct pcd_kv_hdr hdr;
+	struct iovec iov;
+	struct iov_iter iter;
+	ssize_t ret;
+
+	if(req->value_len > buf->size || len > buf->size)
+		return -ENOSPC;
+
+	if(len > buf->size - kv->tail){
+		ret = pcd_kv_compact(kv,buf);
+		if(ret)
+			return ret;
+		if(len > buf->size - kv->tail)
+			return -ENOSPC;
+	}
+
+	slot = pcd_kv_find(kv,buf,key,req->key_len,hash,true);
+	if(!slot)
+		return -ENOSPC;
+
+	/*the entry only becomes part of the log with its header, so a value
+	which faults half way leaves nothing behind */
+	ret = pcd_kv_write(buf,kv->tail + sizeof(hdr),key,req->key_len);
+	if(ret)
+		return ret;
+
+	ret = import_single_range(WRITE,u64_to_user_ptr(req->value),req->value_len,&iov,&iter);
+	if(ret)
+		return ret;
+
+	ret = pcd_buffer_copy_from_iter(buf,kv->tail + sizeof(hdr) + req->key_len,req->value_len,&iter);
+	if(ret != req->value_len)
+		return ret < 0 ? ret : -EFAULT;
+
+	hdr.magic = PCD_KV_LIVE;
+	hdr.klen = req->key_len;
+	hdr.vlen = req->value_len;
+	ret = pcd_kv_write(buf,kv->tail,&hdr,sizeof(hdr));
+	if(ret)
+		return ret;
+
+	if(pcd_kv_slot_used(slot))
+		pcd_kv_set_magic(buf,slot->pos - 1,PCD_KV_DEAD);
+
+	slot->hash = hash;
+	slot->pos = kv->tail + 1;
+	pcd_kv_changed(kv,kv->tail,len);
+	kv->tail += len;
+
+	return 0;
+}
+
+static int pcd_kv_delete(struct pcd_kv *kv, struct pcd_buffer *buf, struct pcd_kv_req *req, const void *key)
+{
+	struct pcd_kv_slot *slot;
+
+	slot = pcd_kv_find(kv,buf,key,req->key_len,pcd_kv_hash(key,req->key_len),false);
+	if(!slot)
+		return -ENOENT;
+
+	pcd_kv_set_magic(buf,slot->pos - 1,PCD_KV_DEAD);
+	pcd_kv_changed(kv,slot->pos - 1,sizeof(struct pcd_kv_hdr));
+	slot->pos = PCD_KV_TOMB;
+
+	return 0;
+}
+
+/*the first live entry at or after req->cookie, which moves past it */
+static int pcd_kv_iterate(struct pcd_kv *kv, struct pcd_buffer *buf, struct pcd_kv_req *req)
+{
+	struct pcd_kv_hdr hdr;
+	struct iovec iov;
+	struct iov_iter iter;
+	u64 pos = req->cookie;
+	int ret;
+
+	if(pos % 8)
+		return -EINVAL;
+
+	for(;;){
+		if(pos >= kv->tail)
+			return -ENOENT;
+		pcd_kv_read(buf,pos,&hdr,sizeof(hdr));
+		if(hdr.magic == PCD_KV_LIVE)
+			break;
+		pos += PCD_KV_LEN(hdr.klen,hdr.vlen);
+	}
+
+	if(req->key_len < hdr.klen || req->value_len < hdr.vlen){
+		req->key_len = hdr.klen;
+		req->value_len = hdr.vlen;
+		req->cookie = pos;
+		return -ERANGE;
+	}
+
+	req->key_len = hdr.klen;
+	req->value_len = hdr.vlen;
+
+	ret = import_single_range(READ,u64_to_user_ptr(req->key),hdr.klen,&iov,&iter);
+	if(ret)
+		return ret;
+	if(pcd_buffer_copy_to_iter(buf,pos + sizeof(hdr),hdr.klen,&iter) != hdr.klen)
+		return -EFAULT;
+
+	ret = import_single_range(READ,u64_to_user_ptr(req->value),hdr.vlen,&iov,&iter);
+	if(ret)
+		return ret;
+	if(pcd_buffer_copy_to_iter(buf,pos + sizeof(hdr) + hdr.klen,hdr.vlen,&iter) != hdr.vlen)
+		return -EFAULT;
+
+	req->cookie = pos + PCD_KV_LEN(hdr.klen,hdr.vlen);
+
+	return 0;
+}
+
+long pcd_kv_ioctl(struct file *filp, unsigned int cmd, struct pcd_kv_req __user *ureq)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_kv *kv = &pcdev_data->kv;
+
+	struct pcd_kv_req req;
+
+	struct pcd_buffer *buf;
+
+	void *key = NULL;
+
+	long ret;
+
+	int idx;
+
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_KV)
+		return -EINVAL;
+
+	if(!(filp->f_mode & ((cmd == PCD_IOC_KV_PUT || cmd == PCD_IOC_KV_DELETE) ? FMODE_WRITE : FMODE_READ)))
+		return -EBADF;
+
+	if(copy_from_user(&req,ureq,sizeof(req)))
+		return -EFAULT;
+
+	if(cmd != PCD_IOC_KV_ITERATE){
+		if(!req.key_len || req.key_len > PCD_KV_MAX_KEY)
+			return -EINVAL;
+		key = memdup_user(u64_to_user_ptr(req.key),req.key_len);
+		if(IS_ERR(key))
+			return PTR_ERR(key);
+	}
+
+	/*rwsem keeps holes from being punched under us */
+	mutex_lock(&kv->lock);
+	down_read(&pcdev_data->rwsem);
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	ret = kv->buckets ? 0 : pcd_kv_rebuild(kv,buf);
+	if(!ret){
+		switch(cmd)
+		{
+			case PCD_IOC_KV_GET:
+				ret = pcd_kv_get(kv,buf,&req,key);
+				break;
+			case PCD_IOC_KV_PUT:
+				ret = pcd_kv_put(kv,buf,&req,key);
+				break;
+			case PCD_IOC_KV_DELETE:
+				ret = pcd_kv_delete(kv,buf,&req,key);
+				break;
+			case PCD_IOC_KV_ITERATE:
+				ret = pcd_kv_iterate(kv,buf,&req);
+				break;
+		}
+	}
+
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	up_read(&pcdev_data->rwsem);
+	mutex_unlock(&kv->lock);
+
+	kfree(key);
+
+	/*GET and ITERATE report sizes, even when the buffers were too small */
+	if((!ret || ret == -ERANGE) && (cmd == PCD_IOC_KV_GET || cmd == PCD_IOC_KV_ITERATE)){
+		if(copy_to_user(ureq,&req,sizeof(req)))
+			return -EFAULT;
+	}
+
+	return ret;
+}
+
+/*the index is rebuilt from the log by the next request */
+void pcd_kv_invalidate(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_kv *kv = &pcdev_data->kv;
+
+	mutex_lock(&kv->lock);
+	kvfree(kv->buckets);
+	kv->buckets = NULL;
+	mutex_unlock(&kv->lock);
+}
+
+/*called with mode_lock held and the device closed, the store starts empty */
+int pcd_kv_alloc(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_kv *kv = &pcdev_data->kv;
+
+	ssize_t ret;
+
+	kv->scratch = kmalloc(2 * PCD_KV_MAX_KEY,GFP_KERNEL);
+	if(!kv->scratch)
+		return -ENOMEM;
+
+	ret = pcd_buffer_fill(pcdev_data,0,pcdev_data->pdata.size,0);
+	if(ret < 0){
+		kfree(kv->scratch);
+		kv->scratch = NULL;
+		return ret;
+	}
+
+	pcd_kv_invalidate(pcdev_data);
+
+	return 0;
+}
+
+void pcd_kv_free(struct pcdev_private_data *pcdev_data)
+{
+	pcd_kv_invalidate(pcdev_data);
+	kfree(pcdev_data->kv.scratch);
+	pcdev_data->kv.scratch = NULL;
+}
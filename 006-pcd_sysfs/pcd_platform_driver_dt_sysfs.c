@@ -21,9 +21,14 @@ struct file_operations pcd_fops=
 {
 	.open = pcd_open,
 	.release = pcd_release,
-	.read = pcd_read,
-	.write = pcd_write,
+	.read_iter = pcd_read_iter,
+	.write_iter = pcd_write_iter,
 	.llseek = pcd_lseek,
+	.splice_read = pcd_splice_read,
+	.splice_write = iter_file_splice_write,
+	.poll = pcd_poll,
+	.mmap = pcd_mmap,
+	.unlocked_ioctl = pcd_ioctl,
 	.owner = THIS_MODULE
 };
 
@@ -45,6 +50,24 @@ ssize_t show_max_size(struct device *dev, struct device_attribute *attr,char *bu
 
 }
 
+ssize_t show_resident_size(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	/* get access to the device private data */
+	struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+	struct pcd_buffer *buffer;
+	unsigned long resident;
+	int idx;
+
+	/*bytes backed by pages, max_size is the logical size */
+	idx = srcu_read_lock(&dev_data->srcu);
+	buffer = srcu_dereference(dev_data->buffer,&dev_data->srcu);
+	resident = atomic_long_read(&buffer->nr_resident) << PAGE_SHIFT;
+	srcu_read_unlock(&dev_data->srcu,idx);
+
+	return sprintf(buf,"%lu\n",resident);
+
+}
+
 ssize_t store_max_size(struct device *dev, struct device_attribute *attr,const char *buf, size_t count)
 {
 	long result;
@@ -55,27 +78,134 @@ ssize_t store_max_size(struct device *dev, struct device_attribute *attr,const c
 	if(ret)
 		return ret;
 
-	dev_data->pdata.size = result;
+	if(result <= 0 || result > INT_MAX)
+		return -EINVAL;
 
-	dev_data->buffer = krealloc(dev_data->buffer,dev_data->pdata.size,GFP_KERNEL);
+	/*the ring of a broadcast device is laid out for its current size */
+	mutex_lock(&dev_data->mode_lock);
+	if(dev_data->mode != PCD_MODE_NORMAL && dev_data->nr_open){
+		mutex_unlock(&dev_data->mode_lock);
+		return -EBUSY;
+	}
+
+	/* swaps in a new buffer without stalling readers, see pcd_buffer_resize */
+	ret = pcd_buffer_resize(dev_data,result);
+
+	/*record positions only make sense for the old size */
+	if(!ret && dev_data->mode == PCD_MODE_RECORD)
+		pcd_records_reset(dev_data);
+
+	/*the key-value index is rebuilt on its next use */
+	if(!ret && dev_data->mode == PCD_MODE_KV)
+		pcd_kv_invalidate(dev_data);
+	mutex_unlock(&dev_data->mode_lock);
+	if(ret)
+		return ret;
+
+	pcd_status_update(dev_data,0,result);
 
 	return count;
 }
 
+static const char * const pcd_mode_names[] =
+{
+	[PCD_MODE_NORMAL] = "normal",
+	[PCD_MODE_BROADCAST] = "broadcast",
+	[PCD_MODE_APPEND] = "append",
+	[PCD_MODE_SHARDED] = "sharded",
+	[PCD_MODE_RECORD] = "record",
+	[PCD_MODE_KV] = "kv",
+};
+
+ssize_t show_mode(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	/* get access to the device private data */
+	struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+
+	return sprintf(buf,"%s\n",pcd_mode_names[READ_ONCE(dev_data->mode)]);
+
+}
+
+ssize_t store_mode(struct device *dev, struct device_attribute *attr,const char *buf, size_t count)
+{
+	struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+	int mode, ret;
+
+	mode = sysfs_match_string(pcd_mode_names,buf);
+	if(mode < 0)
+		return mode;
+
+	/*open files were set up for the old mode */
+	mutex_lock(&dev_data->mode_lock);
+	if(dev_data->nr_open){
+		mutex_unlock(&dev_data->mode_lock);
+		return -EBUSY;
+	}
+
+	ret = 0;
+	switch(mode)
+	{
+		case PCD_MODE_BROADCAST:
+			pcd_bcast_reset(dev_data);
+			break;
+		case PCD_MODE_APPEND:
+			ret = pcd_append_reset(dev_data);
+			break;
+		case PCD_MODE_SHARDED:
+			if(dev_data->mode != PCD_MODE_SHARDED)
+				ret = pcd_shards_alloc(dev_data);
+			break;
+		case PCD_MODE_RECORD:
+			if(dev_data->mode != PCD_MODE_RECORD)
+				ret = pcd_records_alloc(dev_data);
+			break;
+		case PCD_MODE_KV:
+			if(dev_data->mode != PCD_MODE_KV)
+				ret = pcd_kv_alloc(dev_data);
+			break;
+	}
+
+	if(!ret){
+		if(dev_data->mode == PCD_MODE_SHARDED && mode != PCD_MODE_SHARDED)
+			pcd_shards_free(dev_data);
+		if(dev_data->mode == PCD_MODE_RECORD && mode != PCD_MODE_RECORD)
+			pcd_records_free(dev_data);
+		if(dev_data->mode == PCD_MODE_KV && mode != PCD_MODE_KV)
+			pcd_kv_free(dev_data);
+		WRITE_ONCE(dev_data->mode,mode);
+	}
+	mutex_unlock(&dev_data->mode_lock);
+
+	return ret ? ret : count;
+}
+
 /*create 2 variables of struct device_attribute */
 static DEVICE_ATTR(max_size,S_IRUGO|S_IWUSR,show_max_size,store_max_size);
 static DEVICE_ATTR(serial_num,S_IRUGO,show_serial_num,NULL);
+static DEVICE_ATTR(resident_size,S_IRUGO,show_resident_size,NULL);
+static DEVICE_ATTR(stats,S_IRUGO,show_stats,NULL);
+static DEVICE_ATTR(mode,S_IRUGO|S_IWUSR,show_mode,store_mode);
 
 struct attribute *pcd_attrs[] = 
 {
 	&dev_attr_max_size.attr,
 	&dev_attr_serial_num.attr,
+	&dev_attr_resident_size.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_mode.attr,
+	NULL
+};
+
+struct bin_attribute *pcd_bin_attrs[] =
+{
+	&bin_attr_status,
 	NULL
 };
 
 struct attribute_group pcd_attr_group =
 {
-	.attrs = pcd_attrs
+	.attrs = pcd_attrs,
+	.bin_attrs = pcd_bin_attrs
 };
 
 
@@ -92,6 +222,24 @@ int pcd_sysfs_create_files(struct device *pcd_dev)
 
 
 
+/*devres action which frees whatever buffer the device owns at remove time */
+static void pcd_free_buffer(void *data)
+{
+	struct pcdev_private_data *dev_data = data;
+
+	/*pages given up by copy on write are still waiting to be put */
+	srcu_barrier(&dev_data->srcu);
+	cleanup_srcu_struct(&dev_data->srcu);
+	pcd_buffer_free(rcu_dereference_protected(dev_data->buffer,1));
+}
+
+static void pcd_free_append_sem(void *data)
+{
+	struct pcdev_private_data *dev_data = data;
+
+	percpu_free_rwsem(&dev_data->append_sem);
+}
+
 /*Called when the device is removed from the system */
 int pcd_platform_driver_remove(struct platform_device *pdev)
 {
@@ -99,12 +247,22 @@ int pcd_platform_driver_remove(struct platform_device *pdev)
 #if 1
 	struct pcdev_private_data  *dev_data = dev_get_drvdata(&pdev->dev);
 
+	debugfs_remove_recursive(dev_data->debugfs_dir);
+	pcd_status_remove(dev_data);
+
 	/*1. Remove a device that was created with device_create() */
 	device_destroy(pcdrv_data.class_pcd,dev_data->dev_num);
 	
 	/*2. Remove a cdev entry from the system*/
 	cdev_del(&dev_data->cdev);
 
+	if(dev_data->mode == PCD_MODE_SHARDED)
+		pcd_shards_free(dev_data);
+	if(dev_data->mode == PCD_MODE_RECORD)
+		pcd_records_free(dev_data);
+	if(dev_data->mode == PCD_MODE_KV)
+		pcd_kv_free(dev_data);
+
 
 	pcdrv_data.total_devices--;
 
@@ -145,6 +303,9 @@ struct pcdev_platform_data* pcdev_get_platdata_from_dt(struct device *dev)
 		return ERR_PTR(-EINVAL);
 	}
 
+	/*optional, pages of a sparse device are only allocated when written */
+	pdata->sparse = of_property_read_bool(dev_node,"org,sparse");
+
 
 	return pdata;
 
@@ -162,6 +323,8 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 
 	struct pcdev_platform_data *pdata;
 
+	struct pcd_buffer *buffer;
+
 	struct device *dev = &pdev->dev;
 
 	int driver_data;
@@ -203,6 +366,7 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 	dev_data->pdata.size = pdata->size;
 	dev_data->pdata.perm = pdata->perm;
 	dev_data->pdata.serial_number = pdata->serial_number;
+	dev_data->pdata.sparse = pdata->sparse;
 
 	pr_info("Device serial number = %s\n",dev_data->pdata.serial_number);
 	pr_info("Device size = %d\n", dev_data->pdata.size);
@@ -213,12 +377,56 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 
 
 	/*3. Dynamically allocate memory for the device buffer using size 
-	information from the platform data */
-	dev_data->buffer = devm_kzalloc(&pdev->dev,dev_data->pdata.size,GFP_KERNEL);
-	if(!dev_data->buffer){
+	information from the platform data. It is zeroed and made of single pages,
+	which pcd_mmap can map into user space one by one */
+	buffer = pcd_buffer_alloc(dev_data->pdata.size,dev_data->pdata.sparse,&dev_data->srcu);
+	if(!buffer){
 		dev_info(dev,"Cannot allocate memory \n");
 		return -ENOMEM;
 	}
+	RCU_INIT_POINTER(dev_data->buffer,buffer);
+
+	ret = init_srcu_struct(&dev_data->srcu);
+	if(ret){
+		pcd_buffer_free(buffer);
+		return ret;
+	}
+
+	/*store_max_size replaces the buffer, so it is freed through a devres action */
+	ret = devm_add_action_or_reset(dev,pcd_free_buffer,dev_data);
+	if(ret)
+		return ret;
+
+	address_space_init_once(&dev_data->mapping);
+	init_rwsem(&dev_data->rwsem);
+	mutex_init(&dev_data->resize_lock);
+	mutex_init(&dev_data->mode_lock);
+	dev_data->mode = PCD_MODE_NORMAL;
+	INIT_LIST_HEAD(&dev_data->bcast.readers);
+	spin_lock_init(&dev_data->bcast.lock);
+	init_waitqueue_head(&dev_data->bcast.wq);
+	atomic64_set(&dev_data->append_tail,0);
+	mutex_init(&dev_data->shards.read_lock);
+	init_waitqueue_head(&dev_data->shards.wq);
+	mutex_init(&dev_data->records.lock);
+	init_waitqueue_head(&dev_data->records.wq);
+	mutex_init(&dev_data->kv.lock);
+
+	ret = percpu_init_rwsem(&dev_data->append_sem);
+	if(ret)
+		return ret;
+
+	ret = devm_add_action_or_reset(dev,pcd_free_append_sem,dev_data);
+	if(ret)
+		return ret;
+
+	ret = pcd_stats_init(dev,dev_data);
+	if(ret)
+		return ret;
+
+	ret = pcd_status_init(dev,dev_data);
+	if(ret)
+		return ret;
 
 	/*4. Get the device number */
 	dev_data->dev_num = pcdrv_data.device_num_base + pcdrv_data.total_devices;
@@ -252,6 +460,9 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	pcd_stats_debugfs_init(dev_data,dev_name(pcdrv_data.device_pcd));
+	pcd_status_sysfs_init(dev_data,pcdrv_data.device_pcd);
+
 	dev_info(dev,"Probe was successful\n");
 
 	return 0;
@@ -311,6 +522,9 @@ static int __init pcd_platform_driver_init(void)
 		return ret;
 	}
 
+	/*latency histograms of the devices live under <debugfs>/pcd */
+	pcdrv_data.debugfs_root = debugfs_create_dir("pcd",NULL);
+
 	/*3. Register a platform driver */
 	platform_driver_register(&pcd_platform_driver);
 	
@@ -327,6 +541,8 @@ static void __exit pcd_platform_driver_cleanup(void)
 	/*1.Unregister the platform driver */
 	platform_driver_unregister(&pcd_platform_driver);
 
+	debugfs_remove_recursive(pcdrv_data.debugfs_root);
+
 	/*2.Class destroy */
 	class_destroy(pcdrv_data.class_pcd);
 
@@ -12,7 +12,35 @@
 #include<linux/mod_devicetable.h>
 #include<linux/of.h>
 #include<linux/of_device.h>
+#include<linux/mm.h>
+#include<linux/highmem.h>
+#include<linux/xarray.h>
+#include<linux/ktime.h>
+#include<linux/percpu.h>
+#include<linux/u64_stats_sync.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/log2.h>
+#include<linux/jhash.h>
+#include<linux/uio.h>
+#include<linux/splice.h>
+#include<linux/pipe_fs_i.h>
+#include<linux/rwsem.h>
+#include<linux/mutex.h>
+#include<linux/rcupdate.h>
+#include<linux/srcu.h>
+#include<linux/percpu-rwsem.h>
+#include<linux/atomic.h>
+#include<linux/poll.h>
+#include<linux/wait.h>
+#include<linux/eventfd.h>
+#include<linux/anon_inodes.h>
+#include<linux/vmalloc.h>
+#include<linux/file.h>
+#include<linux/jump_label.h>
+#include<linux/workqueue.h>
 #include "platform.h"
+#include "pcd_ioctl.h"
 
 
 #undef pr_fmt
@@ -20,10 +48,88 @@
 
 int check_permission(int dev_perm, int acc_mode);
 loff_t pcd_lseek(struct file *filp, loff_t offset, int whence);
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos);
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
 int pcd_open(struct inode *inode, struct file *filp);
 int pcd_release(struct inode *inode, struct file *filp);
+int pcd_mmap(struct file *filp, struct vm_area_struct *vma);
+long pcd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+ssize_t pcd_fill(struct file *filp, loff_t offset, size_t len, const u8 *pattern, size_t plen);
+__poll_t pcd_poll(struct file *filp, poll_table *wait);
+ssize_t pcd_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+
+struct pcdev_private_data;
+struct pcd_buffer *pcd_buffer_alloc(int size, bool sparse, struct srcu_struct *srcu);
+void pcd_buffer_free(struct pcd_buffer *buf);
+struct page *pcd_buffer_page(struct pcd_buffer *buf, unsigned long index, bool alloc);
+struct page *pcd_buffer_write_page(struct pcd_buffer *buf, unsigned long index, bool alloc);
+size_t pcd_buffer_copy_to_iter(struct pcd_buffer *buf, loff_t pos, size_t count, struct iov_iter *to);
+ssize_t pcd_buffer_copy_from_iter(struct pcd_buffer *buf, loff_t pos, size_t count, struct iov_iter *from);
+int pcd_buffer_punch_hole(struct pcdev_private_data *pcdev_data, loff_t offset, loff_t len);
+int pcd_buffer_resize(struct pcdev_private_data *pcdev_data, int size);
+ssize_t pcd_buffer_fill(struct pcdev_private_data *pcdev_data, loff_t pos, size_t len, int c);
+ssize_t pcd_buffer_fill_pattern(struct pcdev_private_data *pcdev_data, loff_t pos, size_t len,
+				const u8 *pattern, size_t plen);
+ssize_t pcd_buffer_copy_range(struct pcdev_private_data *dst_data, loff_t dpos,
+				struct pcdev_private_data *src_data, loff_t spos, size_t len);
+ssize_t pcd_buffer_clone_range(struct pcdev_private_data *dst_data, loff_t dpos,
+				struct pcdev_private_data *src_data, loff_t spos, size_t len);
+loff_t pcd_buffer_search(struct pcdev_private_data *pcdev_data, loff_t pos, loff_t len,
+				const u8 *pattern, size_t plen);
+vm_fault_t pcd_fault_buffer_page(struct pcdev_private_data *pcdev_data, struct vm_fault *vmf, pgoff_t index);
+
+int pcd_bcast_open(struct file *filp, struct pcdev_private_data *pcdev_data);
+void pcd_bcast_reset(struct pcdev_private_data *pcdev_data);
+
+ssize_t pcd_append_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int pcd_append_reset(struct pcdev_private_data *pcdev_data);
+
+int pcd_shards_alloc(struct pcdev_private_data *pcdev_data);
+void pcd_shards_free(struct pcdev_private_data *pcdev_data);
+ssize_t pcd_shard_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_shard_write_iter(struct kiocb *iocb, struct iov_iter *from);
+
+int pcd_records_alloc(struct pcdev_private_data *pcdev_data);
+void pcd_records_free(struct pcdev_private_data *pcdev_data);
+void pcd_records_reset(struct pcdev_private_data *pcdev_data);
+ssize_t pcd_record_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_record_write_iter(struct kiocb *iocb, struct iov_iter *from);
+loff_t pcd_record_lseek(struct file *filp, loff_t offset, int whence);
+__poll_t pcd_record_poll(struct file *filp, poll_table *wait);
+
+int pcd_status_init(struct device *dev, struct pcdev_private_data *pcdev_data);
+void pcd_status_sysfs_init(struct pcdev_private_data *pcdev_data, struct device *pcd_dev);
+void pcd_status_update(struct pcdev_private_data *pcdev_data, loff_t offset, size_t len);
+void pcd_status_remove(struct pcdev_private_data *pcdev_data);
+extern struct bin_attribute bin_attr_status;
+
+int pcd_kv_alloc(struct pcdev_private_data *pcdev_data);
+void pcd_kv_free(struct pcdev_private_data *pcdev_data);
+void pcd_kv_invalidate(struct pcdev_private_data *pcdev_data);
+long pcd_kv_ioctl(struct file *filp, unsigned int cmd, struct pcd_kv_req __user *ureq);
+
+int pcd_ring_setup(struct pcd_ring_params __user *uparams);
+
+enum pcd_stat_op
+{
+	PCD_STAT_READ,
+	PCD_STAT_WRITE,
+	PCD_STAT_SEEK
+};
+
+struct pcd_stats;
+DECLARE_STATIC_KEY_TRUE(pcd_stats_key);
+int pcd_stats_init(struct device *dev, struct pcdev_private_data *pcdev_data);
+void pcd_stats_account(struct pcdev_private_data *pcdev_data, enum pcd_stat_op op, s64 ret, u64 duration_ns);
+void pcd_stats_sum(struct pcdev_private_data *pcdev_data, struct pcd_stats *sum);
+void pcd_stats_debugfs_init(struct pcdev_private_data *pcdev_data, const char *name);
+ssize_t show_stats(struct device *dev, struct device_attribute *attr,char *buf);
+
+/*the stats module parameter, nothing is counted or timed while it is off */
+static inline bool pcd_stats_enabled(void)
+{
+	return static_branch_likely(&pcd_stats_key);
+}
 
 
 enum pcdev_names
@@ -34,6 +140,16 @@ enum pcdev_names
 	PCDEVD1X
 };
 
+enum pcd_mode
+{
+	PCD_MODE_NORMAL,
+	PCD_MODE_BROADCAST,
+	PCD_MODE_APPEND,
+	PCD_MODE_SHARDED,
+	PCD_MODE_RECORD,
+	PCD_MODE_KV
+};
+
 struct device_config 
 {
 	int config_item1;
@@ -41,13 +157,158 @@ struct device_config
 };
 
 
+/*Memory of a pcdev, replaced as a whole when the device is resized. It is made
+of individually allocated pages, so large sizes need neither high order
+allocations nor vmalloc space. A missing page is a hole which reads as zeroes */
+struct pcd_buffer
+{
+	int size;
+	unsigned long nr_pages;
+	/* page index -> struct page */
+	struct xarray pages;
+	atomic_long_t nr_resident;
+	/* pages are only allocated on first write */
+	bool sparse;
+	/* of the device, pages given up while readers may use them are put after a grace period */
+	struct srcu_struct *srcu;
+};
+
+#define PCD_LAT_BUCKETS 32
+
+/*I/O statistics of a pcdev, one copy per CPU */
+struct pcd_stats
+{
+	u64 reads;
+	u64 writes;
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 seeks;
+	u64 efault;
+	u64 enomem;
+	/* log2 latency histograms, bucket i counts [2^i, 2^(i+1)) ns */
+	u64 read_lat[PCD_LAT_BUCKETS];
+	u64 write_lat[PCD_LAT_BUCKETS];
+	struct u64_stats_sync syncp;
+};
+
+/*A device in broadcast mode is a ring with one writer, which every open file
+consumes at its own pace, see pcd_bcast.c */
+struct pcd_bcast
+{
+	/* bytes written since the device entered the mode */
+	u64 head;
+	/* head plus the write in progress, only moved by the writer */
+	u64 reserve;
+	bool writer;
+	/* open files, each with its own control page */
+	struct list_head readers;
+	/* protects head and readers */
+	spinlock_t lock;
+	wait_queue_head_t wq;
+};
+
+/*One CPU's part of a device in sharded mode, a ring of struct pcd_shard_rec
+records. Only the owning CPU writes to it, with preemption disabled */
+struct pcd_shard
+{
+	void *data;
+	/* free running byte counts, head moved by the owner, tail by readers */
+	unsigned long head;
+	unsigned long tail;
+	/* counts dropped records too, so readers see the gaps */
+	u32 seq;
+};
+
+struct pcd_shards
+{
+	struct pcd_shard __percpu *cpu;
+	/* of every shard, a power of two */
+	unsigned long size;
+	/* readers merge all shards, one at a time */
+	struct mutex read_lock;
+	wait_queue_head_t wq;
+};
+
+/*A device in record mode, see pcd_record.c */
+struct pcd_records
+{
+	/* oldest record still in the buffer, and the next one to be written */
+	u64 first_seq;
+	u64 next_seq;
+	/* free running buffer position of the next record */
+	u64 head;
+	/* seq -> buffer position, index_size is a power of two */
+	u64 *index;
+	unsigned long index_size;
+	struct mutex lock;
+	wait_queue_head_t wq;
+};
+
+/*Hash index of a device in key-value mode, see pcd_kv.c */
+struct pcd_kv_slot
+{
+	u32 hash;
+	u32 pos;
+};
+
+#define PCD_KV_SLOTS	(L1_CACHE_BYTES / sizeof(struct pcd_kv_slot))
+
+struct pcd_kv_bucket
+{
+	struct pcd_kv_slot slot[PCD_KV_SLOTS];
+} ____cacheline_aligned;
+
+struct pcd_kv
+{
+	/* NULL until the next request rebuilds it */
+	struct pcd_kv_bucket *buckets;
+	unsigned long nr_buckets;
+	/* end of the log */
+	u32 tail;
+	/* two keys, for comparisons */
+	void *scratch;
+	struct mutex lock;
+};
+
 /*Device private data structure */
 struct pcdev_private_data
 {
 	struct pcdev_platform_data pdata;
-	char *buffer;
+	/* readers pick it up under srcu, writers under rwsem held for write */
+	struct pcd_buffer __rcu *buffer;
+	struct srcu_struct srcu;
 	dev_t dev_num;
 	struct cdev cdev;
+	/* readers share the buffer, writers own it */
+	struct rw_semaphore rwsem;
+	/* serialises resizes against each other and against mmap faults */
+	struct mutex resize_lock;
+	/* shared by all open files, so a resize can zap every mmap of the buffer */
+	struct address_space mapping;
+	struct pcd_stats __percpu *stats;
+	struct dentry *debugfs_dir;
+	/* mode and nr_open, taken before rwsem */
+	struct mutex mode_lock;
+	int mode;
+	int nr_open;
+	struct pcd_bcast bcast;
+	/* next free byte of the log, see pcd_append.c */
+	atomic64_t append_tail;
+	/* held shared by appenders, exclusive by resize and hole punching */
+	struct percpu_rw_semaphore append_sem;
+	/* only allocated in sharded mode */
+	struct pcd_shards shards;
+	/* only allocated in record mode */
+	struct pcd_records records;
+	/* only allocated in key-value mode */
+	struct pcd_kv kv;
+	/* mmap()able change status, see pcd_status.c */
+	struct page *status_page;
+	struct pcd_status *status;
+	spinlock_t status_lock;
+	struct kernfs_node *status_kn;
+	/* wakes up pollers of the attribute, batching close updates */
+	struct delayed_work status_work;
 };
 
 
@@ -58,7 +319,11 @@ struct pcdrv_private_data
 	dev_t device_num_base;
 	struct class *class_pcd;
 	struct device *device_pcd;
+	struct dentry *debugfs_root;
 };
 
+extern struct pcdrv_private_data pcdrv_data;
+extern struct file_operations pcd_fops;
+
 #endif
 
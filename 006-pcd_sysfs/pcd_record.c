@@ -0,0 +1,338 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Record mode, see pcd_ioctl.h for the format. The buffer of the device is a
+ring of records, the oldest ones are dropped to make room for new ones. The
+file position of a reader is the sequence number of the next record it
+reads, and an index from sequence number to buffer position makes seeking
+to a record O(1) */
+
+#define PCD_REC_LEN(len)	ALIGN(sizeof(struct pcd_rec_hdr) + (len),PCD_LOG_ALIGN)
+
+/*copy between the ring and an iterator at the free running position 'pos',
+wrapping around the end of the buffer */
+static ssize_t pcd_record_copy_in(struct pcd_buffer *buf, u64 pos, size_t len, struct iov_iter *from)
+{
+	size_t chunk;
+	ssize_t ret, n;
+	u32 off;
+
+	div_u64_rem(pos,buf->size,&off);
+	chunk = min_t(size_t,len,buf->size - off);
+
+	ret = pcd_buffer_copy_from_iter(buf,off,chunk,from);
+	if(ret == chunk && len > chunk){
+		n = pcd_buffer_copy_from_iter(buf,0,len - chunk,from);
+		ret = (n < 0) ? n : ret + n;
+	}
+
+	return ret;
+}
+
+static size_t pcd_record_copy_out(struct pcd_buffer *buf, u64 pos, size_t len, struct iov_iter *to)
+{
+	size_t chunk, n;
+	u32 off;
+
+	div_u64_rem(pos,buf->size,&off);
+	chunk = min_t(size_t,len,buf->size - off);
+
+	n = pcd_buffer_copy_to_iter(buf,off,chunk,to);
+	if(n == chunk && len > chunk)
+		n += pcd_buffer_copy_to_iter(buf,0,len - chunk,to);
+
+	return n;
+}
+
+static void pcd_record_read_hdr(struct pcd_buffer *buf, u64 pos, struct pcd_rec_hdr *hdr)
+{
+	struct kvec kv = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+	struct iov_iter iter;
+
+	iov_iter_kvec(&iter,READ,&kv,1,sizeof(*hdr));
+	pcd_record_copy_out(buf,pos,sizeof(*hdr),&iter);
+}
+
+static ssize_t pcd_record_write_hdr(struct pcd_buffer *buf, u64 pos, struct pcd_rec_hdr *hdr)
+{
+	struct kvec kv = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+	struct iov_iter iter;
+
+	iov_iter_kvec(&iter,WRITE,&kv,1,sizeof(*hdr));
+	return pcd_record_copy_in(buf,pos,sizeof(*hdr),&iter);
+}
+
+static u64 *pcd_record_slot(struct pcd_records *records, u64 seq)
+{
+	return &records->index[seq & (records->index_size - 1)];
+}
+
+ssize_t pcd_record_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	struct pcd_records *records = &pcdev_data->records;
+
+	size_t count = iov_iter_count(from);
+
+	size_t reclen = PCD_REC_LEN(count);
+
+	struct pcd_rec_hdr hdr;
+
+	struct pcd_buffer *buf;
+
+	ssize_t ret;
+
+	int idx;
+
+	if(count > U32_MAX)
+		return -EMSGSIZE;
+
+	if(iocb->ki_flags & IOCB_NOWAIT){
+		if(!mutex_trylock(&records->lock))
+			return -EAGAIN;
+	}else{
+		mutex_lock(&records->lock);
+	}
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	if(reclen > buf->size){
+		ret = -EMSGSIZE;
+		goto out;
+	}
+
+	/*make room, in the buffer and in the index */
+	while(records->first_seq != records->next_seq &&
+	      (records->next_seq - records->first_seq == records->index_size ||
+	       records->head + reclen - *pcd_record_slot(records,records->first_seq) > buf->size))
+		records->first_seq++;
+
+	hdr.ts_ns = ktime_get_ns();
+	hdr.seq = records->next_seq;
+	hdr.pid = task_tgid_nr(current);
+	hdr.len = count;
+
+	ret = pcd_record_write_hdr(buf,records->head,&hdr);
+	if(ret == sizeof(hdr))
+		ret = pcd_record_copy_in(buf,records->head + sizeof(hdr),count,from);
+
+	/*a record is only published whole, a failed one leaves its space to the
+	next writer */
+	if(ret != count){
+		if(ret >= 0)
+			ret = -EFAULT;
+		goto out;
+	}
+
+	*pcd_record_slot(records,records->next_seq) = records->head;
+	pcd_status_update(pcdev_data,records->head,reclen);
+	records->head += reclen;
+	records->next_seq++;
+
+	wake_up_interruptible(&records->wq);
+
+out:
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	mutex_unlock(&records->lock);
+
+	return ret;
+}
+
+/*Return the record at the file position, and the ones after it as long as
+they fit. A reader which fell behind the oldest record gets -EPIPE once and
+continues with the oldest one, like /dev/kmsg. Records are copied to user
+space without the lock, so a faulting reader holds up neither the writer nor
+other readers, and checked afterwards for having been overwritten */
+ssize_t pcd_record_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_records *records = &pcdev_data->records;
+
+	struct pcd_rec_hdr hdr;
+
+	struct pcd_buffer *buf;
+
+	size_t reclen, n, done = 0;
+
+	u64 seq = iocb->ki_pos;
+
+	ssize_t ret = 0;
+
+	u64 pos;
+
+	int idx;
+
+	for(;;){
+		if(iocb->ki_flags & IOCB_NOWAIT){
+			if(!mutex_trylock(&records->lock))
+				return -EAGAIN;
+		}else{
+			mutex_lock(&records->lock);
+		}
+
+		if(seq != records->next_seq)
+			break;
+
+		mutex_unlock(&records->lock);
+
+		if((iocb->ki_flags & IOCB_NOWAIT) || (filp->f_flags & O_NONBLOCK))
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(records->wq,READ_ONCE(records->next_seq) != seq);
+		if(ret)
+			return ret;
+	}
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	/*records->lock is held at the top of the loop */
+	for(;;){
+		/*the error return keeps read() from storing ki_pos, so the file
+		position is moved here */
+		if(seq < records->first_seq){
+			if(!done){
+				seq = records->first_seq;
+				filp->f_pos = seq;
+				ret = -EPIPE;
+			}
+			break;
+		}
+
+		if(seq == records->next_seq)
+			break;
+
+		pos = *pcd_record_slot(records,seq);
+		pcd_record_read_hdr(buf,pos,&hdr);
+
+		reclen = PCD_REC_LEN(hdr.len);
+		if(reclen > iov_iter_count(to)){
+			if(!done)
+				ret = -EINVAL;
+			break;
+		}
+
+		mutex_unlock(&records->lock);
+
+		n = pcd_record_copy_out(buf,pos,sizeof(hdr) + hdr.len,to);
+		if(n == sizeof(hdr) + hdr.len)
+			n += iov_iter_zero(reclen - n,to);
+
+		mutex_lock(&records->lock);
+
+		if(n != reclen){
+			ret = -EFAULT;
+			break;
+		}
+
+		/*the writer moves first_seq past a record before it overwrites it,
+		a record overwritten under the copy is not returned */
+		if(seq < records->first_seq)
+			continue;
+
+		done += reclen;
+		seq++;
+	}
+
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	mutex_unlock(&records->lock);
+
+	iocb->ki_pos = seq;
+
+	return done ? done : ret;
+}
+
+/*positions are sequence numbers, SEEK_END is the next record to be written */
+loff_t pcd_record_lseek(struct file *filp, loff_t offset, int whence)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_records *records = &pcdev_data->records;
+
+	loff_t pos;
+
+	mutex_lock(&records->lock);
+
+	switch(whence)
+	{
+		case SEEK_SET:
+			pos = offset;
+			break;
+		case SEEK_CUR:
+			pos = filp->f_pos + offset;
+			break;
+		case SEEK_END:
+			pos = records->next_seq + offset;
+			break;
+		default:
+			pos = -EINVAL;
+	}
+
+	/*a position before the oldest record is allowed, the next read says it is gone */
+	if(pos < 0 || pos > records->next_seq)
+		pos = -EINVAL;
+
+	mutex_unlock(&records->lock);
+
+	if(pos >= 0)
+		filp->f_pos = pos;
+
+	return pos;
+}
+
+__poll_t pcd_record_poll(struct file *filp, poll_table *wait)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_records *records = &pcdev_data->records;
+
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp,&records->wq,wait);
+
+	mutex_lock(&records->lock);
+	if(filp->f_pos != records->next_seq)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	mutex_unlock(&records->lock);
+
+	return mask;
+}
+
+/*drop all records, sequence numbers go on where they were */
+void pcd_records_reset(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_records *records = &pcdev_data->records;
+
+	mutex_lock(&records->lock);
+	records->first_seq = records->next_seq;
+	records->head = 0;
+	mutex_unlock(&records->lock);
+}
+
+/*called with mode_lock held and the device closed. The index has a slot for
+every 64 bytes of the device */
+int pcd_records_alloc(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_records *records = &pcdev_data->records;
+
+	records->index_size = roundup_pow_of_two(max(pcdev_data->pdata.size / 64,16));
+	records->index = kvcalloc(records->index_size,sizeof(*records->index),GFP_KERNEL);
+	if(!records->index)
+		return -ENOMEM;
+
+	pcd_records_reset(pcdev_data);
+
+	return 0;
+}
+
+void pcd_records_free(struct pcdev_private_data *pcdev_data)
+{
+	kvfree(pcdev_data->records.index);
+	pcdev_data->records.index = NULL;
+}
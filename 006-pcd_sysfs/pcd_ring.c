@@ -0,0 +1,251 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Submission/completion rings shared with user space, see pcd_ioctl.h for
+the layout. A ring is not tied to one pcdev, every entry names the pcdev fd
+it goes to. Entries are run in the context of the thread which rings the
+doorbell, so they see its files and its address space */
+
+struct pcd_ring
+{
+	void *mem;
+	struct pcd_ring_hdr *hdr;
+	struct pcd_sqe *sqes;
+	struct pcd_cqe *cqes;
+	/* private copies, user space may scribble over the shared header */
+	u32 sq_entries;
+	u32 cq_entries;
+	u32 sq_head;
+	u32 cq_tail;
+	struct eventfd_ctx *evfd;
+	/* serializes doorbells */
+	struct mutex lock;
+};
+
+static s64 pcd_ring_issue(const struct pcd_sqe *sqe)
+{
+	struct file *file;
+
+	struct kiocb kiocb;
+
+	struct iovec iov;
+
+	struct iov_iter iter;
+
+	int rw;
+
+	ssize_t ret;
+
+	if(sqe->offset > LLONG_MAX || sqe->len > MAX_RW_COUNT)
+		return -EINVAL;
+
+	file = fget(sqe->fd);
+	if(!file)
+		return -EBADF;
+
+	if(file->f_op != &pcd_fops){
+		ret = -EBADF;
+		goto out;
+	}
+
+	switch(sqe->op)
+	{
+		case PCD_OP_READ:
+		case PCD_OP_WRITE:
+			rw = (sqe->op == PCD_OP_WRITE) ? WRITE : READ;
+			if(!(file->f_mode & ((rw == WRITE) ? FMODE_WRITE : FMODE_READ))){
+				ret = -EBADF;
+				break;
+			}
+			ret = import_single_range(rw,u64_to_user_ptr(sqe->addr),sqe->len,&iov,&iter);
+			if(ret)
+				break;
+			/*positioned like pread/pwrite, the file position is left alone */
+			init_sync_kiocb(&kiocb,file);
+			kiocb.ki_pos = sqe->offset;
+			if(rw == WRITE)
+				ret = pcd_write_iter(&kiocb,&iter);
+			else
+				ret = pcd_read_iter(&kiocb,&iter);
+			break;
+		case PCD_OP_FILL:
+			ret = pcd_fill(file,sqe->offset,sqe->len,&sqe->fill,1);
+			break;
+		default:
+			ret = -EINVAL;
+	}
+
+out:
+	fput(file);
+	return ret;
+}
+
+/*Run up to 'to_submit' pending entries. Submission stops early when the
+completion queue is full, the entries left over stay queued for the next
+doorbell */
+static long pcd_ring_enter(struct pcd_ring *ring, unsigned int to_submit)
+{
+	struct pcd_ring_hdr *hdr = ring->hdr;
+
+	struct pcd_sqe sqe;
+
+	struct pcd_cqe *cqe;
+
+	u32 sq_tail, cq_head;
+
+	unsigned int done = 0;
+
+	mutex_lock(&ring->lock);
+
+	/*pairs with the release of sq_tail and cq_head by user space, entries
+	before the tail are fully written */
+	sq_tail = smp_load_acquire(&hdr->sq_tail);
+	cq_head = smp_load_acquire(&hdr->cq_head);
+
+	while(done < to_submit && ring->sq_head != sq_tail &&
+	      ring->cq_tail - cq_head < ring->cq_entries){
+		/*copied once, user space may change the slot while we work */
+		memcpy(&sqe,&ring->sqes[ring->sq_head & (ring->sq_entries - 1)],sizeof(sqe));
+		ring->sq_head++;
+
+		cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+		cqe->user_data = sqe.user_data;
+		cqe->res = pcd_ring_issue(&sqe);
+		ring->cq_tail++;
+
+		done++;
+	}
+
+	/*completions are visible before the new tail */
+	smp_store_release(&hdr->sq_head,ring->sq_head);
+	smp_store_release(&hdr->cq_tail,ring->cq_tail);
+
+	mutex_unlock(&ring->lock);
+
+	if(done && ring->evfd)
+		eventfd_signal(ring->evfd,1);
+
+	return done;
+}
+
+static long pcd_ring_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct pcd_ring *ring = filp->private_data;
+
+	switch(cmd)
+	{
+		case PCD_IOC_RING_ENTER:
+			return pcd_ring_enter(ring,min_t(unsigned long,arg,UINT_MAX));
+		default:
+			return -ENOTTY;
+	}
+}
+
+static int pcd_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct pcd_ring *ring = filp->private_data;
+
+	return remap_vmalloc_range(vma,ring->mem,vma->vm_pgoff);
+}
+
+static void pcd_ring_free(struct pcd_ring *ring)
+{
+	if(ring->evfd)
+		eventfd_ctx_put(ring->evfd);
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+static int pcd_ring_release(struct inode *inode, struct file *filp)
+{
+	pcd_ring_free(filp->private_data);
+
+	return 0;
+}
+
+static const struct file_operations pcd_ring_fops =
+{
+	.release = pcd_ring_release,
+	.mmap = pcd_ring_mmap,
+	.unlocked_ioctl = pcd_ring_ioctl,
+	.owner = THIS_MODULE
+};
+
+/*create a ring as described by 'uparams' and return its fd */
+int pcd_ring_setup(struct pcd_ring_params __user *uparams)
+{
+	struct pcd_ring_params params;
+
+	struct pcd_ring *ring;
+
+	int ret;
+
+	if(copy_from_user(&params,uparams,sizeof(params)))
+		return -EFAULT;
+
+	if(!params.sq_entries || params.sq_entries > PCD_RING_MAX_ENTRIES ||
+	   params.cq_entries > 2 * PCD_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	params.sq_entries = roundup_pow_of_two(params.sq_entries);
+	if(params.cq_entries)
+		params.cq_entries = roundup_pow_of_two(params.cq_entries);
+	else
+		params.cq_entries = 2 * params.sq_entries;
+
+	if(params.cq_entries < params.sq_entries)
+		return -EINVAL;
+
+	/*header, submission and completion queues on their own cache lines */
+	params.sq_off = L1_CACHE_ALIGN(sizeof(struct pcd_ring_hdr));
+	params.cq_off = L1_CACHE_ALIGN(params.sq_off + params.sq_entries * sizeof(struct pcd_sqe));
+	params.size = PAGE_ALIGN(params.cq_off + params.cq_entries * sizeof(struct pcd_cqe));
+
+	ring = kzalloc(sizeof(*ring),GFP_KERNEL);
+	if(!ring)
+		return -ENOMEM;
+
+	mutex_init(&ring->lock);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+
+	ring->mem = vmalloc_user(params.size);
+	if(!ring->mem){
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	ring->hdr = ring->mem;
+	ring->sqes = ring->mem + params.sq_off;
+	ring->cqes = ring->mem + params.cq_off;
+	ring->hdr->sq_entries = params.sq_entries;
+	ring->hdr->sq_mask = params.sq_entries - 1;
+	ring->hdr->cq_entries = params.cq_entries;
+	ring->hdr->cq_mask = params.cq_entries - 1;
+
+	if(params.eventfd >= 0){
+		ring->evfd = eventfd_ctx_fdget(params.eventfd);
+		if(IS_ERR(ring->evfd)){
+			ret = PTR_ERR(ring->evfd);
+			ring->evfd = NULL;
+			goto free;
+		}
+	}
+
+	/*before the fd exists, it cannot be taken back once installed */
+	if(copy_to_user(uparams,&params,sizeof(params))){
+		ret = -EFAULT;
+		goto free;
+	}
+
+	ret = anon_inode_getfd("[pcd_ring]",&pcd_ring_fops,ring,O_RDWR | O_CLOEXEC);
+	if(ret < 0)
+		goto free;
+
+	return ret;
+
+free:
+	pcd_ring_free(ring);
+	return ret;
+}
@@ -0,0 +1,168 @@
+/*
+ * Reader/writer stress test of a pcdev, to measure how reads scale with the
+ * number of readers under the per-device rwsem.
+ *
+ * For n = 1..readers it runs n threads which pread() the same block over and
+ * over, optionally with one thread which keeps rewriting the block, each byte
+ * of a write with the same value. A read which does not return one value for
+ * the whole block saw a half written range and is counted as torn.
+ *
+ * Build on the target (or with $(CROSS_COMPILE)gcc):
+ *	gcc -O2 -pthread -o pcd_rw_stress pcd_rw_stress.c
+ * Run:
+ *	./pcd_rw_stress /dev/pcdev-0 [readers] [seconds] [block size] [writer 0/1]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *path;
+static size_t block = 512;
+static atomic_int stop;
+
+struct worker
+{
+	pthread_t thread;
+	int fd;
+	unsigned long ops;
+	unsigned long torn;
+};
+
+static void *reader(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char *buf = malloc(block);
+	ssize_t n, i;
+
+	if(!buf)
+		return NULL;
+
+	while(!atomic_load_explicit(&stop,memory_order_relaxed)){
+		n = pread(w->fd,buf,block,0);
+		if(n < 0){
+			perror("pread");
+			break;
+		}
+		for(i = 1 ; i < n ; i++){
+			if(buf[i] != buf[0]){
+				w->torn++;
+				break;
+			}
+		}
+		w->ops++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char *buf = malloc(block);
+	unsigned char c = 0;
+
+	if(!buf)
+		return NULL;
+
+	while(!atomic_load_explicit(&stop,memory_order_relaxed)){
+		memset(buf,c++,block);
+		if(pwrite(w->fd,buf,block,0) < 0){
+			perror("pwrite");
+			break;
+		}
+		w->ops++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int run(int nr_readers, int seconds, int with_writer)
+{
+	struct worker *w = calloc(nr_readers + 1,sizeof(*w));
+	struct timespec t0, t1;
+	unsigned long reads = 0, torn = 0;
+	double elapsed;
+	int i, flags;
+
+	if(!w)
+		return -ENOMEM;
+
+	atomic_store(&stop,0);
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+
+	/*every thread has its own file, like separate processes would */
+	for(i = 0 ; i < nr_readers + with_writer ; i++){
+		flags = (i < nr_readers) ? O_RDONLY : O_WRONLY;
+		w[i].fd = open(path,flags);
+		if(w[i].fd < 0){
+			perror(path);
+			exit(1);
+		}
+		pthread_create(&w[i].thread,NULL,(i < nr_readers) ? reader : writer,&w[i]);
+	}
+
+	sleep(seconds);
+	atomic_store(&stop,1);
+
+	for(i = 0 ; i < nr_readers + with_writer ; i++){
+		pthread_join(w[i].thread,NULL);
+		close(w[i].fd);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	for(i = 0 ; i < nr_readers ; i++){
+		reads += w[i].ops;
+		torn += w[i].torn;
+	}
+
+	printf("%7d %14.0f %14.0f %14.0f %8lu\n",nr_readers,reads / elapsed,
+	       reads / elapsed / nr_readers,with_writer ? w[nr_readers].ops / elapsed : 0.0,torn);
+
+	free(w);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int readers = 4, seconds = 5, with_writer = 1;
+	int n;
+
+	if(argc < 2){
+		fprintf(stderr,"usage: %s <device> [readers] [seconds] [block size] [writer 0/1]\n",argv[0]);
+		return 1;
+	}
+
+	path = argv[1];
+	if(argc > 2)
+		readers = atoi(argv[2]);
+	if(argc > 3)
+		seconds = atoi(argv[3]);
+	if(argc > 4)
+		block = strtoul(argv[4],NULL,0);
+	if(argc > 5)
+		with_writer = atoi(argv[5]);
+
+	if(readers < 1 || seconds < 1 || !block){
+		fprintf(stderr,"bad arguments\n");
+		return 1;
+	}
+
+	printf("%zu byte blocks, %d s per step, %s writer\n",block,seconds,with_writer ? "one" : "no");
+	printf("%7s %14s %14s %14s %8s\n","readers","reads/s","per reader","writes/s","torn");
+
+	for(n = 1 ; n <= readers ; n++)
+		run(n,seconds,with_writer);
+
+	return 0;
+}
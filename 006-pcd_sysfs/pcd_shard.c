@@ -0,0 +1,262 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Sharded mode, see pcd_ioctl.h for the record format. A write is copied into
+a bounce buffer first, then appended to the ring of the local CPU with
+preemption disabled, so writers on different CPUs share no cache lines and
+no atomics. Readers merge the rings by timestamp under a mutex of their own */
+
+#define PCD_SHARD_REC_ALIGN(len)	ALIGN(sizeof(struct pcd_shard_rec) + (len),PCD_LOG_ALIGN)
+
+/*copy to and from the ring at the free running position 'pos', wrapping
+around its end */
+static void pcd_shard_copy_in(struct pcd_shards *shards, struct pcd_shard *shard,
+				unsigned long pos, const void *src, size_t len)
+{
+	unsigned long off = pos & (shards->size - 1);
+	size_t chunk = min_t(size_t,len,shards->size - off);
+
+	memcpy(shard->data + off,src,chunk);
+	memcpy(shard->data,src + chunk,len - chunk);
+}
+
+static void pcd_shard_copy_out(struct pcd_shards *shards, struct pcd_shard *shard,
+				unsigned long pos, void *dst, size_t len)
+{
+	unsigned long off = pos & (shards->size - 1);
+	size_t chunk = min_t(size_t,len,shards->size - off);
+
+	memcpy(dst,shard->data + off,chunk);
+	memcpy(dst + chunk,shard->data,len - chunk);
+}
+
+static size_t pcd_shard_copy_to_iter(struct pcd_shards *shards, struct pcd_shard *shard,
+				unsigned long pos, size_t len, struct iov_iter *to)
+{
+	unsigned long off = pos & (shards->size - 1);
+	size_t chunk = min_t(size_t,len,shards->size - off);
+	size_t n;
+
+	n = copy_to_iter(shard->data + off,chunk,to);
+	if(n == chunk)
+		n += copy_to_iter(shard->data,len - chunk,to);
+
+	return n;
+}
+
+ssize_t pcd_shard_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	struct pcd_shards *shards = &pcdev_data->shards;
+
+	size_t count = iov_iter_count(from);
+
+	struct pcd_shard_rec rec;
+
+	struct pcd_shard *shard;
+
+	unsigned long head;
+
+	size_t reclen;
+
+	ssize_t ret;
+
+	void *data;
+
+	if(!count)
+		return 0;
+
+	reclen = PCD_SHARD_REC_ALIGN(count);
+	if(count > U16_MAX || reclen > shards->size)
+		return -EMSGSIZE;
+
+	/*the copy from user space may sleep, which it must not do on the ring */
+	data = kmalloc(count,GFP_KERNEL);
+	if(!data)
+		return -ENOMEM;
+
+	if(!copy_from_iter_full(data,count,from)){
+		kfree(data);
+		return -EFAULT;
+	}
+
+	shard = get_cpu_ptr(shards->cpu);
+
+	head = shard->head;
+	rec.seq = shard->seq++;
+
+	/*pairs with the release of tail by a reader, it is done with the space */
+	if(reclen > shards->size - (head - smp_load_acquire(&shard->tail))){
+		ret = -ENOSPC;
+	}else{
+		rec.ts_ns = ktime_get_ns();
+		rec.cpu = smp_processor_id();
+		rec.len = count;
+		pcd_shard_copy_in(shards,shard,head,&rec,sizeof(rec));
+		pcd_shard_copy_in(shards,shard,head + sizeof(rec),data,count);
+		/*readers which see the new head see the record */
+		smp_store_release(&shard->head,head + reclen);
+		ret = count;
+	}
+
+	put_cpu_ptr(shards->cpu);
+
+	kfree(data);
+
+	if(ret < 0)
+		return ret;
+
+	/*the rings are not part of the buffer, there is no range to report */
+	pcd_status_update(pcdev_data,0,0);
+
+	if(wq_has_sleeper(&shards->wq))
+		wake_up_interruptible(&shards->wq);
+
+	return ret;
+}
+
+/*the shard holding the oldest record, NULL if all are empty */
+static struct pcd_shard *pcd_shard_oldest(struct pcd_shards *shards, struct pcd_shard_rec *oldest)
+{
+	struct pcd_shard *shard, *best = NULL;
+
+	struct pcd_shard_rec rec;
+
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards->cpu,cpu);
+		if(smp_load_acquire(&shard->head) == shard->tail)
+			continue;
+		pcd_shard_copy_out(shards,shard,shard->tail,&rec,sizeof(rec));
+		if(!best || rec.ts_ns < oldest->ts_ns){
+			best = shard;
+			*oldest = rec;
+		}
+	}
+
+	return best;
+}
+
+static bool pcd_shards_empty(struct pcd_shards *shards)
+{
+	struct pcd_shard *shard;
+
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards->cpu,cpu);
+		if(READ_ONCE(shard->head) != READ_ONCE(shard->tail))
+			return false;
+	}
+
+	return true;
+}
+
+/*Hand out whole records, oldest first, as many as fit in the user buffer.
+Records written after the merge started may be older than those already
+returned, since every CPU takes its timestamps on its own */
+ssize_t pcd_shard_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_shards *shards = &pcdev_data->shards;
+
+	struct pcd_shard_rec rec;
+
+	struct pcd_shard *shard;
+
+	size_t reclen, n, done = 0;
+
+	ssize_t ret = 0;
+
+	for(;;){
+		if(iocb->ki_flags & IOCB_NOWAIT){
+			if(!mutex_trylock(&shards->read_lock))
+				return -EAGAIN;
+		}else{
+			mutex_lock(&shards->read_lock);
+		}
+
+		while((shard = pcd_shard_oldest(shards,&rec))){
+			reclen = PCD_SHARD_REC_ALIGN(rec.len);
+			if(reclen > iov_iter_count(to)){
+				if(!done)
+					ret = -EMSGSIZE;
+				break;
+			}
+
+			n = pcd_shard_copy_to_iter(shards,shard,shard->tail,sizeof(rec) + rec.len,to);
+			if(n == sizeof(rec) + rec.len)
+				n += iov_iter_zero(reclen - n,to);
+			if(n != reclen){
+				ret = -EFAULT;
+				break;
+			}
+
+			/*the writer may reuse the space from now on */
+			smp_store_release(&shard->tail,shard->tail + reclen);
+			done += reclen;
+		}
+
+		mutex_unlock(&shards->read_lock);
+
+		if(done || ret)
+			break;
+
+		if((iocb->ki_flags & IOCB_NOWAIT) || (filp->f_flags & O_NONBLOCK))
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(shards->wq,!pcd_shards_empty(shards));
+		if(ret)
+			return ret;
+	}
+
+	return done ? done : ret;
+}
+
+/*called with mode_lock held and the device closed. Every CPU gets an equal
+part of the device size, at least a page, in memory local to it */
+int pcd_shards_alloc(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_shards *shards = &pcdev_data->shards;
+
+	struct pcd_shard *shard;
+
+	int cpu;
+
+	shards->size = rounddown_pow_of_two(max_t(unsigned long,
+				pcdev_data->pdata.size / num_possible_cpus(),PAGE_SIZE));
+
+	shards->cpu = alloc_percpu(struct pcd_shard);
+	if(!shards->cpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu){
+		shard = per_cpu_ptr(shards->cpu,cpu);
+		shard->data = kvmalloc_node(shards->size,GFP_KERNEL,cpu_to_node(cpu));
+		if(!shard->data){
+			pcd_shards_free(pcdev_data);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void pcd_shards_free(struct pcdev_private_data *pcdev_data)
+{
+	struct pcd_shards *shards = &pcdev_data->shards;
+
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kvfree(per_cpu_ptr(shards->cpu,cpu)->data);
+
+	free_percpu(shards->cpu);
+	shards->cpu = NULL;
+}
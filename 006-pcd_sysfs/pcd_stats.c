@@ -0,0 +1,220 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*Per device I/O statistics. Every CPU counts into its own copy, so the hot
+path never bounces a shared cache line, and the copies are only summed up
+when somebody looks at them */
+
+DEFINE_STATIC_KEY_TRUE(pcd_stats_key);
+
+static int pcd_stats_param_set(const char *val, const struct kernel_param *kp)
+{
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(val,&enable);
+	if(ret)
+		return ret;
+
+	if(enable)
+		static_branch_enable(&pcd_stats_key);
+	else
+		static_branch_disable(&pcd_stats_key);
+
+	return 0;
+}
+
+static int pcd_stats_param_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer,"%c\n",static_key_enabled(&pcd_stats_key) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops pcd_stats_param_ops =
+{
+	.set = pcd_stats_param_set,
+	.get = pcd_stats_param_get,
+};
+
+module_param_cb(stats,&pcd_stats_param_ops,NULL,0644);
+MODULE_PARM_DESC(stats,"count I/O statistics and latencies (default Y)");
+
+int pcd_stats_init(struct device *dev, struct pcdev_private_data *pcdev_data)
+{
+	int cpu;
+
+	pcdev_data->stats = devm_alloc_percpu(dev,struct pcd_stats);
+	if(!pcdev_data->stats)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(pcdev_data->stats,cpu)->syncp);
+
+	return 0;
+}
+
+/*bucket i counts operations which took [2^i, 2^(i+1)) ns, the last one
+everything slower */
+static unsigned int pcd_lat_bucket(u64 duration_ns)
+{
+	if(!duration_ns)
+		return 0;
+
+	return min_t(unsigned int,ilog2(duration_ns),PCD_LAT_BUCKETS - 1);
+}
+
+void pcd_stats_account(struct pcdev_private_data *pcdev_data, enum pcd_stat_op op, s64 ret, u64 duration_ns)
+{
+	struct pcd_stats *stats;
+
+	stats = get_cpu_ptr(pcdev_data->stats);
+	u64_stats_update_begin(&stats->syncp);
+
+	switch(op)
+	{
+		case PCD_STAT_READ:
+			stats->reads++;
+			if(ret > 0)
+				stats->bytes_out += ret;
+			stats->read_lat[pcd_lat_bucket(duration_ns)]++;
+			break;
+		case PCD_STAT_WRITE:
+			stats->writes++;
+			if(ret > 0)
+				stats->bytes_in += ret;
+			stats->write_lat[pcd_lat_bucket(duration_ns)]++;
+			break;
+		case PCD_STAT_SEEK:
+			stats->seeks++;
+			break;
+	}
+
+	if(ret == -EFAULT)
+		stats->efault++;
+	else if(ret == -ENOMEM)
+		stats->enomem++;
+
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(pcdev_data->stats);
+}
+
+/*add up the copies of all CPUs into 'sum' */
+void pcd_stats_sum(struct pcdev_private_data *pcdev_data, struct pcd_stats *sum)
+{
+	struct pcd_stats *stats, snap;
+	unsigned int start;
+	int cpu, i;
+
+	memset(sum,0,sizeof(*sum));
+
+	for_each_possible_cpu(cpu){
+		stats = per_cpu_ptr(pcdev_data->stats,cpu);
+
+		do{
+			start = u64_stats_fetch_begin(&stats->syncp);
+			snap = *stats;
+		}while(u64_stats_fetch_retry(&stats->syncp,start));
+
+		sum->reads += snap.reads;
+		sum->writes += snap.writes;
+		sum->bytes_in += snap.bytes_in;
+		sum->bytes_out += snap.bytes_out;
+		sum->seeks += snap.seeks;
+		sum->efault += snap.efault;
+		sum->enomem += snap.enomem;
+
+		for(i = 0 ; i < PCD_LAT_BUCKETS ; i++){
+			sum->read_lat[i] += snap.read_lat[i];
+			sum->write_lat[i] += snap.write_lat[i];
+		}
+	}
+}
+
+ssize_t show_stats(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	/* get access to the device private data */
+	struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+	struct pcd_stats *sum;
+	ssize_t len;
+	int i;
+
+	sum = kmalloc(sizeof(*sum),GFP_KERNEL);
+	if(!sum)
+		return -ENOMEM;
+
+	pcd_stats_sum(dev_data,sum);
+
+	len = scnprintf(buf,PAGE_SIZE,
+			"reads %llu\nwrites %llu\nbytes_in %llu\nbytes_out %llu\n"
+			"seeks %llu\nefault %llu\nenomem %llu\n",
+			sum->reads,sum->writes,sum->bytes_in,sum->bytes_out,
+			sum->seeks,sum->efault,sum->enomem);
+
+	/*one line per histogram, bucket i counts [2^i, 2^(i+1)) ns */
+	len += scnprintf(buf + len,PAGE_SIZE - len,"read_lat_log2_ns");
+	for(i = 0 ; i < PCD_LAT_BUCKETS ; i++)
+		len += scnprintf(buf + len,PAGE_SIZE - len," %llu",sum->read_lat[i]);
+
+	len += scnprintf(buf + len,PAGE_SIZE - len,"\nwrite_lat_log2_ns");
+	for(i = 0 ; i < PCD_LAT_BUCKETS ; i++)
+		len += scnprintf(buf + len,PAGE_SIZE - len," %llu",sum->write_lat[i]);
+
+	len += scnprintf(buf + len,PAGE_SIZE - len,"\n");
+
+	kfree(sum);
+
+	return len;
+}
+
+static void pcd_lat_hist_show(struct seq_file *s, u64 *hist)
+{
+	int i;
+
+	seq_printf(s,"%12s %12s %12s\n","from_ns","to_ns","count");
+
+	for(i = 0 ; i < PCD_LAT_BUCKETS ; i++){
+		if(!hist[i])
+			continue;
+		if(i == PCD_LAT_BUCKETS - 1)
+			seq_printf(s,"%12llu %12s %12llu\n",1ULL << i,"inf",hist[i]);
+		else
+			seq_printf(s,"%12llu %12llu %12llu\n",1ULL << i,1ULL << (i + 1),hist[i]);
+	}
+}
+
+static int pcd_lat_show(struct seq_file *s, bool write)
+{
+	struct pcd_stats *sum;
+
+	sum = kmalloc(sizeof(*sum),GFP_KERNEL);
+	if(!sum)
+		return -ENOMEM;
+
+	pcd_stats_sum(s->private,sum);
+	pcd_lat_hist_show(s,write ? sum->write_lat : sum->read_lat);
+
+	kfree(sum);
+
+	return 0;
+}
+
+static int read_latency_show(struct seq_file *s, void *unused)
+{
+	return pcd_lat_show(s,false);
+}
+DEFINE_SHOW_ATTRIBUTE(read_latency);
+
+static int write_latency_show(struct seq_file *s, void *unused)
+{
+	return pcd_lat_show(s,true);
+}
+DEFINE_SHOW_ATTRIBUTE(write_latency);
+
+/*latency histograms under <debugfs>/pcd/<device name>/ */
+void pcd_stats_debugfs_init(struct pcdev_private_data *pcdev_data, const char *name)
+{
+	pcdev_data->debugfs_dir = debugfs_create_dir(name,pcdrv_data.debugfs_root);
+
+	debugfs_create_file("read_latency",0444,pcdev_data->debugfs_dir,pcdev_data,&read_latency_fops);
+	debugfs_create_file("write_latency",0444,pcdev_data->debugfs_dir,pcdev_data,&write_latency_fops);
+}
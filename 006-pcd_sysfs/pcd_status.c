@@ -0,0 +1,121 @@
+
+#include "pcd_platform_driver_dt_sysfs.h"
+
+
+/*A page per device which tells watchers whether the device changed, without
+a syscall. It is read-only to user space and exported as the binary sysfs
+attribute 'status', which can be mmap()ed. The generation is a sequence
+count: odd while an update is in progress, so a watcher reads it, then the
+other fields, and retries if the generation moved in between */
+
+/*Pollers are woken from a work item at most this often. kernfs_notify takes
+a global lock and queues work of its own, too much for every write, and a
+poller only needs to learn that the page changed */
+#define PCD_STATUS_NOTIFY_MS	10
+
+static void pcd_status_notify(struct work_struct *work)
+{
+	struct pcdev_private_data *pcdev_data = container_of(to_delayed_work(work),
+						struct pcdev_private_data,status_work);
+
+	struct kernfs_node *kn = READ_ONCE(pcdev_data->status_kn);
+
+	if(kn)
+		kernfs_notify(kn);
+}
+
+static void pcd_free_status(void *data)
+{
+	struct pcdev_private_data *pcdev_data = data;
+
+	cancel_delayed_work_sync(&pcdev_data->status_work);
+	__free_page(pcdev_data->status_page);
+}
+
+int pcd_status_init(struct device *dev, struct pcdev_private_data *pcdev_data)
+{
+	pcdev_data->status_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if(!pcdev_data->status_page)
+		return -ENOMEM;
+
+	pcdev_data->status = page_address(pcdev_data->status_page);
+	pcdev_data->status->size = pcdev_data->pdata.size;
+	spin_lock_init(&pcdev_data->status_lock);
+	INIT_DELAYED_WORK(&pcdev_data->status_work,pcd_status_notify);
+
+	return devm_add_action_or_reset(dev,pcd_free_status,pcdev_data);
+}
+
+/*poll() on the attribute wakes up after updates. Called once the attribute
+exists */
+void pcd_status_sysfs_init(struct pcdev_private_data *pcdev_data, struct device *pcd_dev)
+{
+	pcdev_data->status_kn = sysfs_get_dirent(pcd_dev->kobj.sd,"status");
+}
+
+void pcd_status_update(struct pcdev_private_data *pcdev_data, loff_t offset, size_t len)
+{
+	struct pcd_status *status = pcdev_data->status;
+
+	spin_lock(&pcdev_data->status_lock);
+
+	WRITE_ONCE(status->generation,status->generation + 1);
+	smp_wmb();
+	status->last_offset = offset;
+	status->last_len = len;
+	status->size = pcdev_data->pdata.size;
+	smp_wmb();
+	WRITE_ONCE(status->generation,status->generation + 1);
+
+	spin_unlock(&pcdev_data->status_lock);
+
+	/*a no-op while the work is pending. It is no longer pending once it
+	runs, so an update racing with the notify gets one of its own */
+	if(READ_ONCE(pcdev_data->status_kn))
+		schedule_delayed_work(&pcdev_data->status_work,msecs_to_jiffies(PCD_STATUS_NOTIFY_MS));
+}
+
+/*before the attribute goes away */
+void pcd_status_remove(struct pcdev_private_data *pcdev_data)
+{
+	struct kernfs_node *kn = pcdev_data->status_kn;
+
+	WRITE_ONCE(pcdev_data->status_kn,NULL);
+	cancel_delayed_work_sync(&pcdev_data->status_work);
+	sysfs_put(kn);
+}
+
+static ssize_t read_status(struct file *filp, struct kobject *kobj,
+				struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct pcdev_private_data *dev_data = dev_get_drvdata(kobj_to_dev(kobj)->parent);
+
+	spin_lock(&dev_data->status_lock);
+	memcpy(buf,(void *)dev_data->status + off,count);
+	spin_unlock(&dev_data->status_lock);
+
+	return count;
+}
+
+static int mmap_status(struct file *filp, struct kobject *kobj,
+				struct bin_attribute *attr, struct vm_area_struct *vma)
+{
+	struct pcdev_private_data *dev_data = dev_get_drvdata(kobj_to_dev(kobj)->parent);
+
+	if(vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	if(vma->vm_flags & VM_WRITE)
+		return -EACCES;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return vm_insert_page(vma,vma->vm_start,dev_data->status_page);
+}
+
+struct bin_attribute bin_attr_status =
+{
+	.attr = { .name = "status", .mode = S_IRUGO },
+	.size = sizeof(struct pcd_status),
+	.read = read_status,
+	.mmap = mmap_status,
+};
@@ -1,6 +1,9 @@
 
 #include "pcd_platform_driver_dt_sysfs.h"
 
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
 
 int check_permission(int dev_perm, int acc_mode)
 {
@@ -21,7 +24,7 @@ int check_permission(int dev_perm, int acc_mode)
 }
 
 
-loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+static loff_t pcd_do_lseek(struct file *filp, loff_t offset, int whence)
 {
 
 	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
@@ -30,8 +33,9 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 	
 	loff_t temp;
 
-	pr_info("lseek requested \n");
-	pr_info("Current value of the file position = %lld\n",filp->f_pos);
+	/*seeks go by sequence number in record mode */
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_RECORD)
+		return pcd_record_lseek(filp,offset,whence);
 
 	switch(whence)
 	{
@@ -55,77 +59,363 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 		default:
 			return -EINVAL;
 	}
-	
-	pr_info("New value of the file position = %lld\n",filp->f_pos);
 
 	return filp->f_pos;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+/*IOCB_NOWAIT callers must not sleep on the device semaphore */
+static int pcd_down_read(struct pcdev_private_data *pcdev_data, struct kiocb *iocb)
 {
-	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+	if(iocb->ki_flags & IOCB_NOWAIT)
+		return down_read_trylock(&pcdev_data->rwsem) ? 0 : -EAGAIN;
 
-	int max_size = pcdev_data->pdata.size;
+	down_read(&pcdev_data->rwsem);
+	return 0;
+}
+
+static int pcd_down_write(struct pcdev_private_data *pcdev_data, struct kiocb *iocb)
+{
+	if(iocb->ki_flags & IOCB_NOWAIT)
+		return down_write_trylock(&pcdev_data->rwsem) ? 0 : -EAGAIN;
+
+	down_write(&pcdev_data->rwsem);
+	return 0;
+}
+
+static ssize_t pcd_do_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	int max_size;
+
+	loff_t *f_pos = &iocb->ki_pos;
+
+	size_t count = iov_iter_count(to);
+
+	struct pcd_buffer *buf;
 
-	pr_info("Read requested for %zu bytes \n",count);
-	pr_info("Current file position = %lld\n",*f_pos);
+	int ret, idx;
 
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_SHARDED)
+		return pcd_shard_read_iter(iocb,to);
+
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_RECORD)
+		return pcd_record_read_iter(iocb,to);
+
+	/*readers run in parallel, only a writer excludes them */
+	ret = pcd_down_read(pcdev_data,iocb);
+	if(ret)
+		return ret;
+
+	/*a concurrent resize does not stall us, the buffer picked up here stays
+	valid until srcu_read_unlock */
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	max_size = buf->size;
+
+	/* the buffer may have shrunk below the file position */
+	if(*f_pos >= max_size){
+		srcu_read_unlock(&pcdev_data->srcu,idx);
+		up_read(&pcdev_data->rwsem);
+		return 0;
+	}
 	
 	/* Adjust the 'count' */
 	if((*f_pos + count) > max_size)
 		count = max_size - *f_pos;
 
-	/*copy to user */
-	if(copy_to_user(buff,pcdev_data->buffer+(*f_pos),count)){
+	/*copy to user, scattering over all the iovecs of a readv() in one go */
+	count = pcd_buffer_copy_to_iter(buf,*f_pos,count,to);
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	up_read(&pcdev_data->rwsem);
+	if(!count && iov_iter_count(to)){
 		return -EFAULT;
 	}
 
 	/*update the current file postion */
 	*f_pos += count;
 
-	pr_info("Number of bytes successfully read = %zu\n",count);
-	pr_info("Updated file position = %lld\n",*f_pos);
-
 	/*Return number of bytes which have been successfully read */
 	return count;
 
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
 
-	int max_size = pcdev_data->pdata.size;
-	
-	pr_info("Write requested for %zu bytes\n",count);
-	pr_info("Current file position = %lld\n",*f_pos);
+	int max_size;
+
+	loff_t *f_pos = &iocb->ki_pos;
+
+	size_t count = iov_iter_count(from);
+
+	struct pcd_buffer *buf;
+
+	ssize_t ret;
+
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_SHARDED)
+		return pcd_shard_write_iter(iocb,from);
+
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_RECORD)
+		return pcd_record_write_iter(iocb,from);
+
+	/*the log of a key-value device is only written through its ioctls */
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_KV)
+		return -EINVAL;
+
+	/*appends reserve their own space and do not need the device to themselves */
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_APPEND)
+		return pcd_append_write_iter(iocb,from);
+
+	/*a writer owns the buffer, so readers never see a half written range */
+	ret = pcd_down_write(pcdev_data,iocb);
+	if(ret)
+		return ret;
+
+	/*a resize holds rwsem for read while it swaps the buffer, so it cannot
+	change under us */
+	buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->rwsem));
+
+	max_size = buf->size;
 
-	
 	/* Adjust the 'count' */
-	if((*f_pos + count) > max_size)
+	if(*f_pos >= max_size)
+		count = 0;
+	else if((*f_pos + count) > max_size)
 		count = max_size - *f_pos;
 
 	if(!count){
-		pr_err("No space left on the device \n");
+		up_write(&pcdev_data->rwsem);
 		return -ENOMEM;
 	}
 
-	/*copy from user */
-	if(copy_from_user(pcdev_data->buffer+(*f_pos),buff,count)){
-		return -EFAULT;
+	/*copy from user, gathering all the iovecs of a writev() in one go.
+	Holes of a sparse device get their pages here */
+	ret = pcd_buffer_copy_from_iter(buf,*f_pos,count,from);
+	up_write(&pcdev_data->rwsem);
+	if(ret <= 0){
+		return ret ? ret : -EFAULT;
 	}
+	count = ret;
+
+	pcd_status_update(pcdev_data,*f_pos,count);
 
 	/*update the current file postion */
 	*f_pos += count;
 
-	pr_info("Number of bytes successfully written = %zu\n",count);
-	pr_info("Updated file position = %lld\n",*f_pos);
-
 	/*Return number of bytes which have been successfully written */
 	return count;
 
 }
 
+/*Buffer pages are stolen by nobody, they still belong to the device */
+static int pcd_pipe_buf_steal(struct pipe_inode_info *pipe, struct pipe_buffer *buf)
+{
+	return 1;
+}
+
+static const struct pipe_buf_operations pcd_pipe_buf_ops =
+{
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = pcd_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static void pcd_spd_release_page(struct splice_pipe_desc *spd, unsigned int i)
+{
+	put_page(spd->pages[i]);
+}
+
+/*Hand references to the buffer pages of a normal device to the pipe instead
+of copying them, like splice from the page cache does. Data written to the
+device later shows through the pipe buffers that are still unread */
+static ssize_t pcd_do_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)in->private_data;
+
+	struct page *pages[PIPE_DEF_BUFFERS];
+
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &pcd_pipe_buf_ops,
+		.spd_release = pcd_spd_release_page,
+	};
+
+	struct pcd_buffer *buf;
+
+	struct page *page;
+
+	loff_t pos = *ppos;
+
+	size_t n;
+
+	ssize_t ret;
+
+	int idx;
+
+	if(flags & SPLICE_F_NONBLOCK){
+		if(!down_read_trylock(&pcdev_data->rwsem))
+			return -EAGAIN;
+	}else{
+		down_read(&pcdev_data->rwsem);
+	}
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	if(pos >= buf->size)
+		len = 0;
+	else if(pos + len > buf->size)
+		len = buf->size - pos;
+
+	while(len && spd.nr_pages < PIPE_DEF_BUFFERS){
+		n = min_t(size_t,len,PAGE_SIZE - offset_in_page(pos));
+
+		/*holes of a sparse device read as the shared zero page */
+		page = pcd_buffer_page(buf,pos >> PAGE_SHIFT,false);
+		if(!page)
+			page = ZERO_PAGE(0);
+		get_page(page);
+
+		pages[spd.nr_pages] = page;
+		partial[spd.nr_pages].offset = offset_in_page(pos);
+		partial[spd.nr_pages].len = n;
+		spd.nr_pages++;
+
+		pos += n;
+		len -= n;
+	}
+
+	/*the page references keep the data alive past a resize or a punched hole */
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	up_read(&pcdev_data->rwsem);
+
+	if(!spd.nr_pages)
+		return 0;
+
+	ret = splice_to_pipe(pipe,&spd);
+	if(ret > 0)
+		*ppos += ret;
+
+	return ret;
+}
+
+/*The file operations below wrap the ones above with a tracepoint and the
+per-CPU statistics of the device. The clock is only read when one of them is
+on, so with both off they cost no more than two static branches */
+loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_lseek_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 duration;
+
+	loff_t ret;
+
+	ret = pcd_do_lseek(filp,offset,whence);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_lseek(MINOR(pcdev_data->dev_num),offset,whence,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_SEEK,ret,duration);
+
+	return ret;
+}
+
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_read_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 duration;
+
+	loff_t pos = iocb->ki_pos;
+
+	size_t count = iov_iter_count(to);
+
+	ssize_t ret;
+
+	ret = pcd_do_read_iter(iocb,to);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_read(MINOR(pcdev_data->dev_num),pos,count,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_READ,ret,duration);
+
+	return ret;
+}
+
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)iocb->ki_filp->private_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_write_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 duration;
+
+	loff_t pos = iocb->ki_pos;
+
+	size_t count = iov_iter_count(from);
+
+	ssize_t ret;
+
+	ret = pcd_do_write_iter(iocb,from);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_write(MINOR(pcdev_data->dev_num),pos,count,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_WRITE,ret,duration);
+
+	return ret;
+}
+
+ssize_t pcd_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)in->private_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_read_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 duration;
+
+	loff_t pos = *ppos;
+
+	ssize_t ret;
+
+	/*only the buffer of a normal device is plain data which can be handed
+	out as pages, the other modes frame and lock their reads in read_iter.
+	generic_file_splice_read goes through pcd_read_iter, which traces and
+	counts the read itself */
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+		return generic_file_splice_read(in,ppos,pipe,len,flags);
+
+	ret = pcd_do_splice_read(in,ppos,pipe,len,flags);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_read(MINOR(pcdev_data->dev_num),pos,len,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_READ,ret,duration);
+
+	return ret;
+}
+
 
 
 int pcd_open(struct inode *inode, struct file *filp)
@@ -147,10 +437,27 @@ int pcd_open(struct inode *inode, struct file *filp)
 
 	/*to supply device private data to other methods of the driver */
 	filp->private_data = pcdev_data;
+
+	/*mmaps of this file are tracked in the device's mapping, see store_max_size */
+	filp->f_mapping = &pcdev_data->mapping;
+
+	/*read_iter/write_iter only trylock the device for IOCB_NOWAIT requests,
+	so io_uring may issue them inline instead of punting them to a worker */
+	filp->f_mode |= FMODE_NOWAIT;
 		
 	/*check permission */
 	ret = check_permission(pcdev_data->pdata.perm,filp->f_mode);
 
+	/*the mode only changes while the device is closed, see store_mode */
+	if(!ret){
+		mutex_lock(&pcdev_data->mode_lock);
+		if(pcdev_data->mode == PCD_MODE_BROADCAST)
+			ret = pcd_bcast_open(filp,pcdev_data);
+		if(!ret)
+			pcdev_data->nr_open++;
+		mutex_unlock(&pcdev_data->mode_lock);
+	}
+
 	(!ret)?pr_info("open was successful\n"):pr_info("open was unsuccessful\n");
 
 	return ret;
@@ -158,8 +465,402 @@ int pcd_open(struct inode *inode, struct file *filp)
 
 int pcd_release(struct inode *inode, struct file *flip)
 {
+	struct pcdev_private_data *pcdev_data = container_of(inode->i_cdev,struct pcdev_private_data,cdev);
+
+	mutex_lock(&pcdev_data->mode_lock);
+	pcdev_data->nr_open--;
+	mutex_unlock(&pcdev_data->mode_lock);
+
 	pr_info("release was successful\n");
 
 	return 0;
 }
 
+/*only record mode has to wait for data, the other modes are always ready */
+__poll_t pcd_poll(struct file *filp, poll_table *wait)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	if(READ_ONCE(pcdev_data->mode) == PCD_MODE_RECORD)
+		return pcd_record_poll(filp,wait);
+
+	return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+}
+
+/*map page 'index' of the buffer at the faulting address */
+vm_fault_t pcd_fault_buffer_page(struct pcdev_private_data *pcdev_data, struct vm_fault *vmf, pgoff_t index)
+{
+	struct pcd_buffer *buf;
+
+	struct page *page;
+
+	vm_fault_t ret;
+
+	/*the pte is installed under resize_lock, so a resize which zaps the
+	mappings afterwards cannot leave a pte to its old buffer behind */
+	mutex_lock(&pcdev_data->resize_lock);
+
+	buf = rcu_dereference_protected(pcdev_data->buffer,
+				lockdep_is_held(&pcdev_data->resize_lock));
+
+	/* the buffer may have shrunk since the mapping was created */
+	if(index >= buf->nr_pages){
+		mutex_unlock(&pcdev_data->resize_lock);
+		return VM_FAULT_SIGBUS;
+	}
+
+	/*holes of a sparse device are filled on any access, a read fault cannot
+	share the zero page since the mapping is writable. For the same reason a
+	page shared with another device gets a copy of its own first */
+	page = pcd_buffer_write_page(buf,index,true);
+	if(!IS_ERR(page))
+		ret = vmf_insert_pfn(vmf->vma,vmf->address,page_to_pfn(page));
+	else
+		ret = VM_FAULT_OOM;
+
+	mutex_unlock(&pcdev_data->resize_lock);
+
+	return ret;
+}
+
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+	return pcd_fault_buffer_page(vmf->vma->vm_private_data,vmf,vmf->pgoff);
+}
+
+static const struct vm_operations_struct pcd_vm_ops =
+{
+	.fault = pcd_vm_fault,
+};
+
+int pcd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	int perm = pcdev_data->pdata.perm;
+
+	unsigned long len = vma->vm_end - vma->vm_start;
+
+	/* a mapped page is always readable, so write only devices cannot be mapped */
+	if(!(perm & RDONLY))
+		return -EACCES;
+
+	/*the other modes keep rings, logs and indexes in the buffer, which
+	stores through a mapping would corrupt */
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+		return -EINVAL;
+
+	/*enforce the pcdev permission on shared mappings and on later mprotect() */
+	if(!(perm & WRONLY) && (vma->vm_flags & VM_SHARED)){
+		if(vma->vm_flags & VM_WRITE)
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	/*private mappings would need copy on write of raw pfns */
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	if((vma->vm_pgoff << PAGE_SHIFT) + len > PAGE_ALIGN(pcdev_data->pdata.size))
+		return -EINVAL;
+
+	/* pages are inserted lazily by pcd_vm_fault, so a resize only has to zap the ptes */
+	vma->vm_flags |= VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_ops = &pcd_vm_ops;
+	vma->vm_private_data = pcdev_data;
+
+	return 0;
+}
+
+/*one entry of a batch, the caller holds rwsem and the srcu read lock */
+static ssize_t pcd_batch_one(struct pcd_buffer *buf, struct pcd_io_desc *desc)
+{
+	struct iovec iov;
+
+	struct iov_iter iter;
+
+	size_t count = desc->len;
+
+	ssize_t ret;
+
+	if(desc->offset >= buf->size)
+		return desc->op == PCD_IO_WRITE ? -ENOMEM : 0;
+
+	if(desc->offset + count > buf->size)
+		count = buf->size - desc->offset;
+
+	if(!count)
+		return 0;
+
+	ret = import_single_range(desc->op == PCD_IO_WRITE ? WRITE : READ,
+				u64_to_user_ptr(desc->buf),count,&iov,&iter);
+	if(ret)
+		return ret;
+
+	if(desc->op == PCD_IO_WRITE)
+		ret = pcd_buffer_copy_from_iter(buf,desc->offset,count,&iter);
+	else
+		ret = pcd_buffer_copy_to_iter(buf,desc->offset,count,&iter);
+
+	return ret ? ret : -EFAULT;
+}
+
+static long pcd_ioctl_batch(struct file *filp, struct pcd_io_batch __user *ubatch)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_io_batch batch;
+
+	struct pcd_io_desc *descs;
+
+	struct pcd_buffer *buf;
+
+	bool write = false;
+
+	u64 start;
+
+	u32 i;
+
+	int ret, idx;
+
+	if(copy_from_user(&batch,ubatch,sizeof(batch)))
+		return -EFAULT;
+
+	if(!batch.count || batch.count > PCD_IO_BATCH_MAX)
+		return -EINVAL;
+
+	/*entries go straight to the buffer, which is only plain data in normal mode */
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+		return -EINVAL;
+
+	/*once for the whole batch instead of once per access */
+	ret = check_permission(pcdev_data->pdata.perm,filp->f_mode);
+	if(ret)
+		return ret;
+
+	descs = memdup_user(u64_to_user_ptr(batch.descs),batch.count * sizeof(*descs));
+	if(IS_ERR(descs))
+		return PTR_ERR(descs);
+
+	for(i = 0 ; i < batch.count ; i++){
+		if(descs[i].op > PCD_IO_WRITE || descs[i].offset > LLONG_MAX ||
+		   descs[i].len > MAX_RW_COUNT){
+			ret = -EINVAL;
+			goto out;
+		}
+		if(descs[i].op == PCD_IO_WRITE)
+			write = true;
+		if(!(filp->f_mode & (descs[i].op == PCD_IO_WRITE ? FMODE_WRITE : FMODE_READ))){
+			ret = -EBADF;
+			goto out;
+		}
+	}
+
+	/*the lock is taken once, exclusive if any entry writes */
+	if(write)
+		down_write(&pcdev_data->rwsem);
+	else
+		down_read(&pcdev_data->rwsem);
+
+	idx = srcu_read_lock(&pcdev_data->srcu);
+	buf = srcu_dereference(pcdev_data->buffer,&pcdev_data->srcu);
+
+	for(i = 0 ; i < batch.count ; i++){
+		start = pcd_stats_enabled() ? ktime_get_ns() : 0;
+		descs[i].result = pcd_batch_one(buf,&descs[i]);
+		if(pcd_stats_enabled())
+			pcd_stats_account(pcdev_data,
+					descs[i].op == PCD_IO_WRITE ? PCD_STAT_WRITE : PCD_STAT_READ,
+					descs[i].result,ktime_get_ns() - start);
+	}
+
+	srcu_read_unlock(&pcdev_data->srcu,idx);
+	if(write)
+		up_write(&pcdev_data->rwsem);
+	else
+		up_read(&pcdev_data->rwsem);
+
+	for(i = 0 ; i < batch.count ; i++){
+		if(descs[i].op == PCD_IO_WRITE && descs[i].result > 0)
+			pcd_status_update(pcdev_data,descs[i].offset,descs[i].result);
+	}
+
+	if(copy_to_user(u64_to_user_ptr(batch.descs),descs,batch.count * sizeof(*descs)))
+		ret = -EFAULT;
+
+out:
+	kfree(descs);
+	return ret;
+}
+
+/*FILL of the ioctl and of ring entries, which is accounted as a write. Only
+the buffer of a device in normal mode is plain data that may be overwritten */
+ssize_t pcd_fill(struct file *filp, loff_t offset, size_t len, const u8 *pattern, size_t plen)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	bool timed = pcd_stats_enabled() || trace_pcd_write_enabled();
+
+	u64 start = timed ? ktime_get_ns() : 0;
+
+	u64 duration;
+
+	ssize_t ret;
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+		ret = -EINVAL;
+	else
+		ret = pcd_buffer_fill_pattern(pcdev_data,offset,len,pattern,plen);
+
+	duration = timed ? ktime_get_ns() - start : 0;
+	trace_pcd_write(MINOR(pcdev_data->dev_num),offset,len,ret,duration);
+	if(pcd_stats_enabled())
+		pcd_stats_account(pcdev_data,PCD_STAT_WRITE,ret,duration);
+
+	return ret;
+}
+
+static long pcd_ioctl_fill(struct file *filp, struct pcd_fill_req __user *ureq)
+{
+	struct pcd_fill_req req;
+
+	if(copy_from_user(&req,ureq,sizeof(req)))
+		return -EFAULT;
+
+	if(req.offset > LLONG_MAX || req.len > MAX_RW_COUNT ||
+	   !req.pattern_len || req.pattern_len > PCD_PATTERN_MAX)
+		return -EINVAL;
+
+	return pcd_fill(filp,req.offset,req.len,req.pattern,req.pattern_len);
+}
+
+/*COPY and CLONE. The source is another pcdev when the request names one, it
+has to be open for reading like the destination has to be open for writing.
+Only pages of a device in normal mode are shared */
+static long pcd_ioctl_copy(struct file *filp, unsigned int cmd, struct pcd_copy_req __user *ureq)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	ssize_t (*copy)(struct pcdev_private_data *, loff_t, struct pcdev_private_data *, loff_t, size_t);
+
+	struct pcdev_private_data *src_data;
+
+	struct pcd_copy_req req;
+
+	struct file *src = NULL;
+
+	long ret;
+
+	copy = (cmd == PCD_IOC_CLONE) ? pcd_buffer_clone_range : pcd_buffer_copy_range;
+
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+		return -EINVAL;
+
+	if(copy_from_user(&req,ureq,sizeof(req)))
+		return -EFAULT;
+
+	if(req.src_off > LLONG_MAX || req.dst_off > LLONG_MAX || req.len > MAX_RW_COUNT)
+		return -EINVAL;
+
+	if(req.src_fd < 0){
+		if(!(filp->f_mode & FMODE_READ))
+			return -EBADF;
+		return copy(pcdev_data,req.dst_off,pcdev_data,req.src_off,req.len);
+	}
+
+	src = fget(req.src_fd);
+	if(!src)
+		return -EBADF;
+
+	if(src->f_op != &pcd_fops || !(src->f_mode & FMODE_READ)){
+		ret = -EBADF;
+		goto out;
+	}
+
+	src_data = src->private_data;
+	if(cmd == PCD_IOC_CLONE && READ_ONCE(src_data->mode) != PCD_MODE_NORMAL){
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = copy(pcdev_data,req.dst_off,src_data,req.src_off,req.len);
+
+out:
+	fput(src);
+	return ret;
+}
+
+static long pcd_ioctl_search(struct file *filp, struct pcd_search_req __user *ureq)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_search_req req;
+
+	loff_t ret;
+
+	if(!(filp->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if(copy_from_user(&req,ureq,sizeof(req)))
+		return -EFAULT;
+
+	if(req.start > LLONG_MAX || req.len > LLONG_MAX ||
+	   !req.pattern_len || req.pattern_len > PCD_PATTERN_MAX)
+		return -EINVAL;
+
+	ret = pcd_buffer_search(pcdev_data,req.start,req.len,req.pattern,req.pattern_len);
+	if(ret < 0)
+		return ret;
+
+	if(put_user(ret,&ureq->result))
+		return -EFAULT;
+
+	return 0;
+}
+
+long pcd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
+
+	struct pcd_range range;
+
+	switch(cmd)
+	{
+		case PCD_IOC_PUNCH_HOLE:
+			/*fallocate(2) stops at the VFS for character devices, so hole
+			punching comes as an ioctl */
+			if(!(filp->f_mode & FMODE_WRITE))
+				return -EBADF;
+			if(READ_ONCE(pcdev_data->mode) != PCD_MODE_NORMAL)
+				return -EINVAL;
+			if(copy_from_user(&range,(void __user *)arg,sizeof(range)))
+				return -EFAULT;
+			if(range.offset > LLONG_MAX || range.len > LLONG_MAX)
+				return -EINVAL;
+			return pcd_buffer_punch_hole(pcdev_data,range.offset,range.len);
+		case PCD_IOC_BATCH:
+			return pcd_ioctl_batch(filp,(struct pcd_io_batch __user *)arg);
+		case PCD_IOC_RING_SETUP:
+			return pcd_ring_setup((struct pcd_ring_params __user *)arg);
+		case PCD_IOC_KV_GET:
+		case PCD_IOC_KV_PUT:
+		case PCD_IOC_KV_DELETE:
+		case PCD_IOC_KV_ITERATE:
+			return pcd_kv_ioctl(filp,cmd,(struct pcd_kv_req __user *)arg);
+		case PCD_IOC_FILL:
+			return pcd_ioctl_fill(filp,(struct pcd_fill_req __user *)arg);
+		case PCD_IOC_COPY:
+		case PCD_IOC_CLONE:
+			return pcd_ioctl_copy(filp,cmd,(struct pcd_copy_req __user *)arg);
+		case PCD_IOC_SEARCH:
+			return pcd_ioctl_search(filp,(struct pcd_search_req __user *)arg);
+		default:
+			return -ENOTTY;
+	}
+}
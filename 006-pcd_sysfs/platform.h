@@ -5,6 +5,7 @@ struct pcdev_platform_data
 	int size;
 	int perm;
 	const char *serial_number;
+	int sparse;
 
 };
 
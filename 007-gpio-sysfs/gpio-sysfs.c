@@ -1,40 +1,10 @@
-#include <linux/module.h>
-#include <linux/kernel.h>
-#include <linux/platform_device.h>
-#include <linux/string.h>
-#include <linux/fs.h>
-#include <asm/uaccess.h>
-#include <linux/init.h>
-#include <linux/device.h>
-#include <linux/io.h>
-#include <linux/of.h>
-#include <linux/of_device.h>
-#include<linux/gpio/consumer.h>
-
-#undef pr_fmt
-#define pr_fmt(fmt) "%s : " fmt,__func__
+#include "gpio-sysfs.h"
 
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Kiran Nayak");
 MODULE_DESCRIPTION("A gpio sysfs driver");
 
-/*Device private data structure */
-struct gpiodev_private_data
-{
-	char label[20];
-	struct gpio_desc *desc;
-};
-
-
-/*Driver private data structure */
-struct gpiodrv_private_data
-{
-	int total_devices;
-	struct class *class_gpio;
-	struct device **dev;
-};
-
 struct gpiodrv_private_data gpio_drv_data;
 
 
@@ -103,15 +73,26 @@ ssize_t label_show(struct device *dev, struct device_attribute *attr,char *buf)
 	return sprintf(buf, "%s\n", dev_data->label);
 }
 
+/*bit of the line in /sys/class/bone_gpios/values and the ioctls */
+ssize_t line_show(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	struct gpiodev_private_data *dev_data = dev_get_drvdata(dev);
+	return sprintf(buf, "%d\n", dev_data->line);
+}
+
 static DEVICE_ATTR_RW(direction);
 static DEVICE_ATTR_RW(value);
 static DEVICE_ATTR_RO(label);
+static DEVICE_ATTR_RO(line);
 
 static struct attribute *gpio_attrs[] = 
 {
 	&dev_attr_direction.attr,
 	&dev_attr_value.attr,
 	&dev_attr_label.attr,
+	&dev_attr_line.attr,
+	&dev_attr_edge.attr,
+	&dev_attr_overflows.attr,
 	NULL
 };
 
@@ -133,6 +114,12 @@ int gpio_sysfs_remove(struct platform_device *pdev)
 	
 	dev_info(&pdev->dev,"Remove called\n");
 
+	gpio_cdev_remove();
+	gpio_wave_remove();
+	gpio_sample_remove();
+	gpio_array_sysfs_remove();
+	gpio_events_remove();
+
 	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
 		device_unregister(gpio_drv_data.dev[i]);
 	}
@@ -165,9 +152,24 @@ int gpio_sysfs_probe(struct platform_device *pdev)
 		return -EINVAL;
 	}
 
+	/*every line is a bit of the masks of the multi-line interfaces */
+	if(gpio_drv_data.total_devices > BONE_GPIO_MAX_LINES){
+		dev_err(dev,"More than %d devices\n",BONE_GPIO_MAX_LINES);
+		return -EINVAL;
+	}
+
 	dev_info(dev,"Total devices found = %d\n",gpio_drv_data.total_devices);
 
+	gpio_events_init();
+	gpio_wave_init();
+	gpio_sample_init();
+
 	gpio_drv_data.dev = devm_kzalloc(dev, sizeof(struct device *) * gpio_drv_data.total_devices , GFP_KERNEL);
+	gpio_drv_data.descs = devm_kcalloc(dev,gpio_drv_data.total_devices,sizeof(*gpio_drv_data.descs),GFP_KERNEL);
+	if(!gpio_drv_data.dev || !gpio_drv_data.descs){
+		dev_err(dev,"Cannot allocate memory\n");
+		return -ENOMEM;
+	}
 
 	for_each_available_child_of_node(parent,child)
 	{
@@ -175,7 +177,8 @@ int gpio_sysfs_probe(struct platform_device *pdev)
 		dev_data = devm_kzalloc(dev,sizeof(*dev_data), GFP_KERNEL);
 		if(!dev_data){
 			dev_err(dev,"Cannot allocate memory\n");
-			return -ENOMEM;
+			ret = -ENOMEM;
+			goto put_child;
 		}
 
 		if(of_property_read_string(child,"label",&name) )
@@ -194,14 +197,18 @@ int gpio_sysfs_probe(struct platform_device *pdev)
 			ret = PTR_ERR(dev_data->desc);
 			if(ret == -ENOENT)
 				dev_err(dev,"No GPIO has been assigned to the requested function and/or index\n");
-			return ret;
+			goto put_child;
 		}
 
+		dev_data->line = i;
+		INIT_KFIFO(dev_data->events);
+		gpio_drv_data.descs[i] = dev_data->desc;
+
 		/* set the gpio direction to output */
 		ret = gpiod_direction_output(dev_data->desc,0);
 		if(ret){
 			dev_err(dev,"gpio direction set failed \n");
-			return ret;
+			goto put_child;
 		}
 
 		/*Create devices under /sys/class/bone_gpios */
@@ -209,15 +216,47 @@ int gpio_sysfs_probe(struct platform_device *pdev)
 								dev_data->label);
 		if(IS_ERR(gpio_drv_data.dev[i])){
 			dev_err(dev,"Error in device_create \n");
-			return PTR_ERR(gpio_drv_data.dev[i]);
+			ret = PTR_ERR(gpio_drv_data.dev[i]);
+			goto put_child;
 		}
 				
 
 		i++;
 
 	}
+
+	/*children which are not available have no line */
+	gpio_drv_data.total_devices = i;
+
+	ret = gpio_array_init(dev);
+	if(ret)
+		goto unregister;
+
+	ret = gpio_array_sysfs_init();
+	if(ret){
+		dev_err(dev,"Error in creating class attributes \n");
+		goto unregister;
+	}
+
+	ret = gpio_cdev_init(dev);
+	if(ret)
+		goto remove_attrs;
+
 	return 0;
 
+remove_attrs:
+	gpio_array_sysfs_remove();
+	goto unregister;
+put_child:
+	of_node_put(child);
+unregister:
+	/*the edge attributes were live, so interrupts may have been requested */
+	gpio_drv_data.total_devices = i;
+	gpio_events_remove();
+	while(i--)
+		device_unregister(gpio_drv_data.dev[i]);
+	return ret;
+
 }
 
 
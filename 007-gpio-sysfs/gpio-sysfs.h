@@ -0,0 +1,132 @@
+#ifndef GPIO_SYSFS_H
+#define GPIO_SYSFS_H
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/platform_device.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <asm/uaccess.h>
+#include <linux/init.h>
+#include <linux/device.h>
+#include <linux/io.h>
+#include <linux/of.h>
+#include <linux/of_device.h>
+#include<linux/gpio/consumer.h>
+#include<linux/gpio/driver.h>
+#include<linux/cdev.h>
+#include<linux/bitmap.h>
+#include<linux/slab.h>
+#include<linux/kfifo.h>
+#include<linux/interrupt.h>
+#include<linux/mutex.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/hrtimer.h>
+#include<linux/ktime.h>
+#include<linux/mm.h>
+#include<linux/vmalloc.h>
+#include<linux/log2.h>
+#include<linux/srcu.h>
+#include "gpio_sysfs_ioctl.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt) "%s : " fmt,__func__
+
+
+#define GPIO_EVENT_FIFO_SIZE	256
+
+/*Device private data structure */
+struct gpiodev_private_data
+{
+	char label[20];
+	struct gpio_desc *desc;
+	/* bit of the line in the masks of the driver */
+	int line;
+	/* BONE_GPIO_EDGE_* bits, the interrupt is requested while set */
+	int edge;
+	int irq;
+	/* with both edges, the last one reported and whether the level after it
+	disagreed, see gpio_event_both */
+	int last_edge;
+	bool mismatch;
+	unsigned long overflows;
+	DECLARE_KFIFO(events,struct bone_gpio_event,GPIO_EVENT_FIFO_SIZE);
+};
+
+
+/*Driver private data structure */
+struct gpiodrv_private_data
+{
+	int total_devices;
+	struct class *class_gpio;
+	struct device **dev;
+	/* line i is bit i of the masks */
+	struct gpio_desc **descs;
+	/* the lines grouped by GPIO chip, and the line of each entry */
+	struct gpio_desc **chip_descs;
+	unsigned int *chip_lines;
+	/* /dev/bone_gpio */
+	dev_t devt;
+	struct cdev cdev;
+	struct device *cdev_dev;
+	/* set when the lines go away under files still open, and bumped so the
+	files of one probe never pass for files of the next */
+	bool cdev_gone;
+	unsigned int cdev_gen;
+	/* serializes changes of the edge of the lines */
+	struct mutex edge_lock;
+	/* set under edge_lock when the interrupts are freed for good */
+	bool edges_removed;
+	/* the single consumer of the event fifos */
+	struct mutex event_read_lock;
+	wait_queue_head_t event_wq;
+};
+
+extern struct gpiodrv_private_data gpio_drv_data;
+
+/*some lines in chip order, ready for gpiod_get/set_array_value */
+struct gpio_lines
+{
+	u64 mask;
+	unsigned int n;
+	struct gpio_desc *descs[BONE_GPIO_MAX_LINES];
+	/* bit of each entry in the masks */
+	unsigned int lines[BONE_GPIO_MAX_LINES];
+};
+
+u64 gpio_array_all_lines(void);
+bool gpio_array_cansleep(u64 mask);
+int gpio_array_init(struct device *dev);
+void gpio_lines_pick(struct gpio_lines *gl, u64 mask);
+int gpio_lines_get(struct gpio_lines *gl, u64 *values, bool cansleep);
+int gpio_lines_set(struct gpio_lines *gl, u64 values, bool cansleep);
+int gpio_array_get(u64 mask, u64 *values);
+int gpio_array_set(u64 mask, u64 values);
+int gpio_array_get_directions(u64 mask, u64 *dirs);
+int gpio_array_set_directions(u64 mask, u64 dirs);
+int gpio_array_sysfs_init(void);
+void gpio_array_sysfs_remove(void);
+
+extern struct device_attribute dev_attr_edge;
+extern struct device_attribute dev_attr_overflows;
+void gpio_events_init(void);
+void gpio_events_remove(void);
+ssize_t gpio_events_read(struct file *filp, char __user *buf, size_t count);
+__poll_t gpio_events_poll(struct file *filp, poll_table *wait);
+
+void gpio_wave_init(void);
+void gpio_wave_remove(void);
+long gpio_wave_ioctl(unsigned int cmd, void __user *argp);
+
+void gpio_sample_init(void);
+void gpio_sample_remove(void);
+long gpio_sample_ioctl(unsigned int cmd, void __user *argp);
+int gpio_sample_mmap(struct file *filp, struct vm_area_struct *vma);
+
+int gpio_cdev_init(struct device *dev);
+void gpio_cdev_remove(void);
+int gpio_cdev_enter(struct file *filp);
+void gpio_cdev_exit(int idx);
+
+#endif
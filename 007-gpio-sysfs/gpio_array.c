@@ -0,0 +1,274 @@
+
+#include "gpio-sysfs.h"
+
+
+/*Access to several lines at once. gpiolib hands the lines of an array which
+sit next to each other and belong to the same chip to the set_multiple and
+get_multiple of the chip in one call, so the lines are kept grouped by chip
+here and a bus on one bank changes with a single register write */
+
+/*mask of all the lines of the driver */
+u64 gpio_array_all_lines(void)
+{
+	if(gpio_drv_data.total_devices >= BONE_GPIO_MAX_LINES)
+		return ~0ULL;
+
+	return BIT_ULL(gpio_drv_data.total_devices) - 1;
+}
+
+/*whether any line in 'mask' sits on a chip which sleeps, those cannot be
+driven from the hrtimers of the waveform player and the sampler */
+bool gpio_array_cansleep(u64 mask)
+{
+	int i;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
+		if((mask & BIT_ULL(i)) && gpiod_cansleep(gpio_drv_data.descs[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/*called once all lines are set up. Lines keep their order within a chip */
+int gpio_array_init(struct device *dev)
+{
+	int n = gpio_drv_data.total_devices;
+
+	struct gpio_chip *chip;
+
+	int i, p, k = 0;
+
+	gpio_drv_data.chip_descs = devm_kcalloc(dev,n,sizeof(*gpio_drv_data.chip_descs),GFP_KERNEL);
+	gpio_drv_data.chip_lines = devm_kcalloc(dev,n,sizeof(*gpio_drv_data.chip_lines),GFP_KERNEL);
+	if(!gpio_drv_data.chip_descs || !gpio_drv_data.chip_lines)
+		return -ENOMEM;
+
+	for(i = 0 ; i < n ; i++){
+		chip = gpiod_to_chip(gpio_drv_data.descs[i]);
+
+		/*right after the last line of the same chip, or at the end */
+		for(p = k ; p > 0 ; p--){
+			if(gpiod_to_chip(gpio_drv_data.chip_descs[p - 1]) == chip)
+				break;
+		}
+		if(!p)
+			p = k;
+
+		memmove(&gpio_drv_data.chip_descs[p + 1],&gpio_drv_data.chip_descs[p],
+			(k - p) * sizeof(*gpio_drv_data.chip_descs));
+		memmove(&gpio_drv_data.chip_lines[p + 1],&gpio_drv_data.chip_lines[p],
+			(k - p) * sizeof(*gpio_drv_data.chip_lines));
+		gpio_drv_data.chip_descs[p] = gpio_drv_data.descs[i];
+		gpio_drv_data.chip_lines[p] = i;
+		k++;
+	}
+
+	return 0;
+}
+
+/*fill 'gl' with the lines in 'mask', in chip order */
+void gpio_lines_pick(struct gpio_lines *gl, u64 mask)
+{
+	unsigned int i;
+
+	gl->mask = mask;
+	gl->n = 0;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
+		if(!(mask & BIT_ULL(gpio_drv_data.chip_lines[i])))
+			continue;
+		gl->descs[gl->n] = gpio_drv_data.chip_descs[i];
+		gl->lines[gl->n] = gpio_drv_data.chip_lines[i];
+		gl->n++;
+	}
+}
+
+/*Process context passes 'cansleep' and may reach lines on chips which sleep,
+like I2C and SPI expanders. The hrtimers of the waveform player and the
+sampler do not, their masks never hold such lines */
+int gpio_lines_get(struct gpio_lines *gl, u64 *values, bool cansleep)
+{
+	DECLARE_BITMAP(bits,BONE_GPIO_MAX_LINES);
+
+	unsigned int i;
+
+	int ret;
+
+	*values = 0;
+
+	if(!gl->n)
+		return 0;
+
+	if(cansleep)
+		ret = gpiod_get_array_value_cansleep(gl->n,gl->descs,NULL,bits);
+	else
+		ret = gpiod_get_array_value(gl->n,gl->descs,NULL,bits);
+	if(ret)
+		return ret;
+
+	for(i = 0 ; i < gl->n ; i++){
+		if(test_bit(i,bits))
+			*values |= BIT_ULL(gl->lines[i]);
+	}
+
+	return 0;
+}
+
+int gpio_lines_set(struct gpio_lines *gl, u64 values, bool cansleep)
+{
+	DECLARE_BITMAP(bits,BONE_GPIO_MAX_LINES);
+
+	unsigned int i;
+
+	if(!gl->n)
+		return 0;
+
+	for(i = 0 ; i < gl->n ; i++)
+		__assign_bit(i,bits,values & BIT_ULL(gl->lines[i]));
+
+	if(cansleep)
+		return gpiod_set_array_value_cansleep(gl->n,gl->descs,NULL,bits);
+
+	return gpiod_set_array_value(gl->n,gl->descs,NULL,bits);
+}
+
+int gpio_array_get(u64 mask, u64 *values)
+{
+	struct gpio_lines gl;
+
+	gpio_lines_pick(&gl,mask);
+
+	return gpio_lines_get(&gl,values,true);
+}
+
+int gpio_array_set(u64 mask, u64 values)
+{
+	struct gpio_lines gl;
+
+	gpio_lines_pick(&gl,mask);
+
+	return gpio_lines_set(&gl,values,true);
+}
+
+/*gpiolib has no array call for directions, they are read and set one line at
+a time. A bit is set for an output */
+int gpio_array_get_directions(u64 mask, u64 *dirs)
+{
+	int i, dir;
+
+	*dirs = 0;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
+		if(!(mask & BIT_ULL(i)))
+			continue;
+		dir = gpiod_get_direction(gpio_drv_data.descs[i]);
+		if(dir < 0)
+			return dir;
+		/* 0 is out, like in direction_show */
+		if(dir == 0)
+			*dirs |= BIT_ULL(i);
+	}
+
+	return 0;
+}
+
+/*only lines whose direction changes are touched, new outputs start low */
+int gpio_array_set_directions(u64 mask, u64 dirs)
+{
+	struct gpio_desc *desc;
+
+	int i, dir, ret = 0;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices && !ret ; i++){
+		if(!(mask & BIT_ULL(i)))
+			continue;
+		desc = gpio_drv_data.descs[i];
+		dir = gpiod_get_direction(desc);
+		if(dir < 0)
+			return dir;
+		if((dirs & BIT_ULL(i)) && dir != 0)
+			ret = gpiod_direction_output(desc,0);
+		else if(!(dirs & BIT_ULL(i)) && dir == 0)
+			ret = gpiod_direction_input(desc);
+	}
+
+	return ret;
+}
+
+/* /sys/class/bone_gpios/values and directions, bit i is line i */
+static ssize_t values_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	u64 values;
+	int ret;
+
+	ret = gpio_array_get(gpio_array_all_lines(),&values);
+	if(ret)
+		return ret;
+
+	return sprintf(buf,"%#llx\n",values);
+}
+
+static ssize_t values_store(struct class *class, struct class_attribute *attr, const char *buf, size_t count)
+{
+	u64 values;
+	int ret;
+
+	ret = kstrtoull(buf,0,&values);
+	if(ret)
+		return ret;
+
+	ret = gpio_array_set(gpio_array_all_lines(),values);
+
+	return ret ? : count;
+}
+
+static ssize_t directions_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	u64 dirs;
+	int ret;
+
+	ret = gpio_array_get_directions(gpio_array_all_lines(),&dirs);
+	if(ret)
+		return ret;
+
+	return sprintf(buf,"%#llx\n",dirs);
+}
+
+static ssize_t directions_store(struct class *class, struct class_attribute *attr, const char *buf, size_t count)
+{
+	u64 dirs;
+	int ret;
+
+	ret = kstrtoull(buf,0,&dirs);
+	if(ret)
+		return ret;
+
+	ret = gpio_array_set_directions(gpio_array_all_lines(),dirs);
+
+	return ret ? : count;
+}
+
+static CLASS_ATTR_RW(values);
+static CLASS_ATTR_RW(directions);
+
+int gpio_array_sysfs_init(void)
+{
+	int ret;
+
+	ret = class_create_file(gpio_drv_data.class_gpio,&class_attr_values);
+	if(ret)
+		return ret;
+
+	ret = class_create_file(gpio_drv_data.class_gpio,&class_attr_directions);
+	if(ret)
+		class_remove_file(gpio_drv_data.class_gpio,&class_attr_values);
+
+	return ret;
+}
+
+void gpio_array_sysfs_remove(void)
+{
+	class_remove_file(gpio_drv_data.class_gpio,&class_attr_directions);
+	class_remove_file(gpio_drv_data.class_gpio,&class_attr_values);
+}
@@ -0,0 +1,300 @@
+
+#include "gpio-sysfs.h"
+
+
+/*/dev/bone_gpio, the lines of the driver as a whole through ioctls, and
+their edge events through read(), see gpio_sysfs_ioctl.h. Every operation is
+a single ioctl with a binary argument, with no parsing or formatting on the
+way */
+
+/*An open file takes what it needs from the line table at open, so an ioctl
+touches nothing but its own data. The lines of the last mask used stay
+picked, a program which drives the same bus over and over goes straight
+to gpiolib */
+struct gpio_cdev_file
+{
+	/* gpio_drv_data.cdev_gen at open */
+	unsigned int gen;
+	u64 all_lines;
+	/* protects cached */
+	struct mutex lock;
+	struct gpio_lines cached;
+};
+
+/*Unbinding the platform device frees the lines while files may stay open.
+Everything a file does with the lines runs between gpio_cdev_enter and
+gpio_cdev_exit: enter fails once the lines the file was opened on are gone,
+and the remove waits for the callers already inside */
+DEFINE_STATIC_SRCU(gpio_cdev_srcu);
+
+int gpio_cdev_enter(struct file *filp)
+{
+	struct gpio_cdev_file *file = filp->private_data;
+
+	int idx;
+
+	idx = srcu_read_lock(&gpio_cdev_srcu);
+	if(file->gen != READ_ONCE(gpio_drv_data.cdev_gen)){
+		srcu_read_unlock(&gpio_cdev_srcu,idx);
+		return -ENODEV;
+	}
+
+	return idx;
+}
+
+void gpio_cdev_exit(int idx)
+{
+	srcu_read_unlock(&gpio_cdev_srcu,idx);
+}
+
+static int gpio_cdev_open(struct inode *inode, struct file *filp)
+{
+	struct gpio_cdev_file *file;
+
+	int idx;
+
+	file = kzalloc(sizeof(*file),GFP_KERNEL);
+	if(!file)
+		return -ENOMEM;
+
+	mutex_init(&file->lock);
+
+	/*an open which raced with cdev_del must not take the lines either */
+	idx = srcu_read_lock(&gpio_cdev_srcu);
+	if(READ_ONCE(gpio_drv_data.cdev_gone)){
+		srcu_read_unlock(&gpio_cdev_srcu,idx);
+		kfree(file);
+		return -ENODEV;
+	}
+	file->gen = READ_ONCE(gpio_drv_data.cdev_gen);
+	file->all_lines = gpio_array_all_lines();
+	gpio_lines_pick(&file->cached,file->all_lines);
+	srcu_read_unlock(&gpio_cdev_srcu,idx);
+
+	filp->private_data = file;
+
+	return nonseekable_open(inode,filp);
+}
+
+static int gpio_cdev_release(struct inode *inode, struct file *filp)
+{
+	kfree(filp->private_data);
+
+	return 0;
+}
+
+/*process context, so the lines may sit on chips which sleep */
+static int gpio_cdev_values(struct gpio_cdev_file *file, unsigned int cmd, struct bone_gpio_values *req)
+{
+	int ret;
+
+	mutex_lock(&file->lock);
+
+	if(req->mask != file->cached.mask)
+		gpio_lines_pick(&file->cached,req->mask);
+
+	if(cmd == BONE_GPIO_SET_VALUES)
+		ret = gpio_lines_set(&file->cached,req->values,true);
+	else
+		ret = gpio_lines_get(&file->cached,&req->values,true);
+
+	mutex_unlock(&file->lock);
+
+	return ret;
+}
+
+static long gpio_cdev_line_info(struct bone_gpio_line_info __user *uinfo)
+{
+	struct gpiodev_private_data *dev_data;
+
+	struct bone_gpio_line_info info;
+
+	int dir;
+
+	if(copy_from_user(&info,uinfo,sizeof(info)))
+		return -EFAULT;
+
+	if(info.line >= gpio_drv_data.total_devices)
+		return -EINVAL;
+
+	dev_data = dev_get_drvdata(gpio_drv_data.dev[info.line]);
+
+	dir = gpiod_get_direction(dev_data->desc);
+	if(dir < 0)
+		return dir;
+
+	info.nr_lines = gpio_drv_data.total_devices;
+	info.flags = (dir == 0) ? BONE_GPIO_LINE_OUTPUT : 0;
+	strscpy(info.label,dev_data->label,sizeof(info.label));
+
+	if(copy_to_user(uinfo,&info,sizeof(info)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static ssize_t gpio_cdev_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+	return gpio_events_read(filp,buf,count);
+}
+
+static long gpio_cdev_do_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct gpio_cdev_file *file = filp->private_data;
+
+	struct bone_gpio_values req;
+
+	void __user *argp = (void __user *)arg;
+
+	int ret;
+
+	switch(cmd)
+	{
+		case BONE_GPIO_GET_LINE_INFO:
+			return gpio_cdev_line_info(argp);
+		case BONE_GPIO_WAVE_LOAD:
+		case BONE_GPIO_WAVE_START:
+		case BONE_GPIO_WAVE_STOP:
+			if(!(filp->f_mode & FMODE_WRITE))
+				return -EBADF;
+			return gpio_wave_ioctl(cmd,argp);
+		case BONE_GPIO_WAVE_STATUS:
+			return gpio_wave_ioctl(cmd,argp);
+		case BONE_GPIO_SAMPLE_SETUP:
+		case BONE_GPIO_SAMPLE_START:
+		case BONE_GPIO_SAMPLE_STOP:
+			if(!(filp->f_mode & FMODE_WRITE))
+				return -EBADF;
+			return gpio_sample_ioctl(cmd,argp);
+	}
+
+	if(_IOC_TYPE(cmd) != BONE_GPIO_IOC_MAGIC || _IOC_SIZE(cmd) != sizeof(req))
+		return -ENOTTY;
+
+	if(copy_from_user(&req,argp,sizeof(req)))
+		return -EFAULT;
+
+	req.mask &= file->all_lines;
+
+	switch(cmd)
+	{
+		case BONE_GPIO_GET_VALUES:
+			ret = gpio_cdev_values(file,cmd,&req);
+			break;
+		case BONE_GPIO_SET_VALUES:
+			if(!(filp->f_mode & FMODE_WRITE))
+				return -EBADF;
+			return gpio_cdev_values(file,cmd,&req);
+		case BONE_GPIO_GET_DIRECTIONS:
+			ret = gpio_array_get_directions(req.mask,&req.values);
+			break;
+		case BONE_GPIO_SET_DIRECTIONS:
+			if(!(filp->f_mode & FMODE_WRITE))
+				return -EBADF;
+			return gpio_array_set_directions(req.mask,req.values);
+		default:
+			return -ENOTTY;
+	}
+
+	if(ret)
+		return ret;
+
+	if(copy_to_user(argp,&req,sizeof(req)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long gpio_cdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	long ret;
+
+	int idx;
+
+	idx = gpio_cdev_enter(filp);
+	if(idx < 0)
+		return idx;
+
+	ret = gpio_cdev_do_ioctl(filp,cmd,arg);
+	gpio_cdev_exit(idx);
+
+	return ret;
+}
+
+static int gpio_cdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	int ret, idx;
+
+	idx = gpio_cdev_enter(filp);
+	if(idx < 0)
+		return idx;
+
+	ret = gpio_sample_mmap(filp,vma);
+	gpio_cdev_exit(idx);
+
+	return ret;
+}
+
+static const struct file_operations gpio_cdev_fops =
+{
+	.open = gpio_cdev_open,
+	.release = gpio_cdev_release,
+	.read = gpio_cdev_read,
+	.poll = gpio_events_poll,
+	.mmap = gpio_cdev_mmap,
+	.unlocked_ioctl = gpio_cdev_ioctl,
+	.llseek = no_llseek,
+	.owner = THIS_MODULE
+};
+
+int gpio_cdev_init(struct device *dev)
+{
+	int ret;
+
+	gpio_drv_data.cdev_gone = false;
+
+	ret = alloc_chrdev_region(&gpio_drv_data.devt,0,1,"bone_gpio");
+	if(ret < 0){
+		dev_err(dev,"Alloc chrdev failed\n");
+		return ret;
+	}
+
+	cdev_init(&gpio_drv_data.cdev,&gpio_cdev_fops);
+	gpio_drv_data.cdev.owner = THIS_MODULE;
+
+	ret = cdev_add(&gpio_drv_data.cdev,gpio_drv_data.devt,1);
+	if(ret < 0){
+		dev_err(dev,"Cdev add failed\n");
+		goto unreg;
+	}
+
+	/*next to the line devices under /sys/class/bone_gpios */
+	gpio_drv_data.cdev_dev = device_create(gpio_drv_data.class_gpio,dev,gpio_drv_data.devt,NULL,"bone_gpio");
+	if(IS_ERR(gpio_drv_data.cdev_dev)){
+		dev_err(dev,"Error in device_create \n");
+		ret = PTR_ERR(gpio_drv_data.cdev_dev);
+		goto del;
+	}
+
+	return 0;
+
+del:
+	cdev_del(&gpio_drv_data.cdev);
+unreg:
+	unregister_chrdev_region(gpio_drv_data.devt,1);
+	return ret;
+}
+
+/*files still open fail from now on, blocked readers wake up to find out */
+void gpio_cdev_remove(void)
+{
+	device_destroy(gpio_drv_data.class_gpio,gpio_drv_data.devt);
+	cdev_del(&gpio_drv_data.cdev);
+
+	WRITE_ONCE(gpio_drv_data.cdev_gone,true);
+	WRITE_ONCE(gpio_drv_data.cdev_gen,gpio_drv_data.cdev_gen + 1);
+	synchronize_srcu(&gpio_cdev_srcu);
+	wake_up_all(&gpio_drv_data.event_wq);
+
+	unregister_chrdev_region(gpio_drv_data.devt,1);
+}
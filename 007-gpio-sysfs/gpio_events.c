@@ -0,0 +1,301 @@
+
+#include "gpio-sysfs.h"
+
+
+/*Edge events. Each line with an edge set has its interrupt, whose hard
+handler timestamps the edge and puts it in the kfifo of the line. A handler
+never runs on two CPUs at once, so it is the only writer of its fifo and
+needs no lock. read() on /dev/bone_gpio merges the fifos by timestamp under
+a mutex of its own, the one reader a kfifo allows */
+
+static const char * const gpio_edge_names[] =
+{
+	[0] = "none",
+	[BONE_GPIO_EDGE_RISING] = "rising",
+	[BONE_GPIO_EDGE_FALLING] = "falling",
+	[BONE_GPIO_EDGE_RISING | BONE_GPIO_EDGE_FALLING] = "both",
+};
+
+static int gpio_level_edge(struct gpiodev_private_data *dev_data)
+{
+	return gpiod_get_value(dev_data->desc) ? BONE_GPIO_EDGE_RISING : BONE_GPIO_EDGE_FALLING;
+}
+
+/*With both edges on one interrupt, edges alternate. The level read in the
+handler cannot tell which edge it was: after a pulse shorter than the
+interrupt latency it is already back where it was, and the edge of the
+pulse would come out twice. The level only resyncs the line when it
+disagrees with the alternation twice in a row, which a short pulse never
+does, since its second edge brings the level in line again. Then an
+interrupt was lost */
+static int gpio_event_both(struct gpiodev_private_data *dev_data)
+{
+	int edge, level;
+
+	edge = (dev_data->last_edge == BONE_GPIO_EDGE_RISING) ? BONE_GPIO_EDGE_FALLING : BONE_GPIO_EDGE_RISING;
+	level = gpio_level_edge(dev_data);
+
+	if(level == edge){
+		dev_data->mismatch = false;
+	}else if(dev_data->mismatch){
+		edge = level;
+		dev_data->mismatch = false;
+	}else{
+		dev_data->mismatch = true;
+	}
+
+	dev_data->last_edge = edge;
+
+	return edge;
+}
+
+static irqreturn_t gpio_event_irq(int irq, void *data)
+{
+	struct gpiodev_private_data *dev_data = data;
+
+	struct bone_gpio_event ev;
+
+	ev.ts_ns = ktime_get_ns();
+	ev.line = dev_data->line;
+
+	if(dev_data->edge == (BONE_GPIO_EDGE_RISING | BONE_GPIO_EDGE_FALLING))
+		ev.edge = gpio_event_both(dev_data);
+	else
+		ev.edge = dev_data->edge;
+
+	if(!kfifo_put(&dev_data->events,ev))
+		WRITE_ONCE(dev_data->overflows,dev_data->overflows + 1);
+
+	if(wq_has_sleeper(&gpio_drv_data.event_wq))
+		wake_up_interruptible(&gpio_drv_data.event_wq);
+
+	return IRQ_HANDLED;
+}
+
+/*called with edge_lock held */
+static int gpio_event_set_edge(struct gpiodev_private_data *dev_data, int edge)
+{
+	unsigned long flags = 0;
+
+	int irq, ret;
+
+	if(dev_data->edge == edge)
+		return 0;
+
+	if(dev_data->edge){
+		free_irq(dev_data->irq,dev_data);
+		dev_data->edge = 0;
+	}
+
+	if(!edge)
+		return 0;
+
+	/*the edge attribute outlives gpio_events_remove until the line devices
+	are unregistered, a handler requested then would outlive the line */
+	if(gpio_drv_data.edges_removed)
+		return -ENODEV;
+
+	irq = gpiod_to_irq(dev_data->desc);
+	if(irq < 0)
+		return irq;
+
+	if(edge & BONE_GPIO_EDGE_RISING)
+		flags |= IRQF_TRIGGER_RISING;
+	if(edge & BONE_GPIO_EDGE_FALLING)
+		flags |= IRQF_TRIGGER_FALLING;
+
+	/*before the interrupt can fire. The first edge is the one away from the
+	current level */
+	dev_data->edge = edge;
+	dev_data->last_edge = gpio_level_edge(dev_data);
+	dev_data->mismatch = false;
+
+	/*gpiolib refuses the interrupt of an output line */
+	ret = request_irq(irq,gpio_event_irq,flags,dev_data->label,dev_data);
+	if(ret){
+		dev_data->edge = 0;
+		return ret;
+	}
+
+	dev_data->irq = irq;
+
+	return 0;
+}
+
+ssize_t edge_show(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	struct gpiodev_private_data *dev_data = dev_get_drvdata(dev);
+	return sprintf(buf,"%s\n",gpio_edge_names[dev_data->edge]);
+}
+
+ssize_t edge_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count)
+{
+	struct gpiodev_private_data *dev_data = dev_get_drvdata(dev);
+	int edge, ret;
+
+	edge = sysfs_match_string(gpio_edge_names,buf);
+	if(edge < 0)
+		return edge;
+
+	mutex_lock(&gpio_drv_data.edge_lock);
+	ret = gpio_event_set_edge(dev_data,edge);
+	mutex_unlock(&gpio_drv_data.edge_lock);
+
+	return ret ? : count;
+}
+
+/*events dropped because the fifo of the line was full */
+ssize_t overflows_show(struct device *dev, struct device_attribute *attr,char *buf)
+{
+	struct gpiodev_private_data *dev_data = dev_get_drvdata(dev);
+	return sprintf(buf,"%lu\n",READ_ONCE(dev_data->overflows));
+}
+
+DEVICE_ATTR_RW(edge);
+DEVICE_ATTR_RO(overflows);
+
+static struct gpiodev_private_data *gpio_line_data(int line)
+{
+	return dev_get_drvdata(gpio_drv_data.dev[line]);
+}
+
+/*the line with the oldest event, NULL if there is none */
+static struct gpiodev_private_data *gpio_events_oldest(struct bone_gpio_event *oldest)
+{
+	struct gpiodev_private_data *dev_data, *best = NULL;
+
+	struct bone_gpio_event ev;
+
+	int i;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
+		dev_data = gpio_line_data(i);
+		if(!kfifo_peek(&dev_data->events,&ev))
+			continue;
+		if(!best || ev.ts_ns < oldest->ts_ns){
+			best = dev_data;
+			*oldest = ev;
+		}
+	}
+
+	return best;
+}
+
+static bool gpio_events_pending(void)
+{
+	int i;
+
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++){
+		if(!kfifo_is_empty(&gpio_line_data(i)->events))
+			return true;
+	}
+
+	return false;
+}
+
+/*the wait condition of a reader, which also ends the wait when the lines
+are gone */
+static bool gpio_events_ready(struct file *filp)
+{
+	bool ready;
+
+	int idx;
+
+	idx = gpio_cdev_enter(filp);
+	if(idx < 0)
+		return true;
+
+	ready = gpio_events_pending();
+	gpio_cdev_exit(idx);
+
+	return ready;
+}
+
+/*as many whole events as fit, oldest first. Every event is read once, by
+whichever reader gets to it */
+ssize_t gpio_events_read(struct file *filp, char __user *buf, size_t count)
+{
+	struct gpiodev_private_data *dev_data;
+
+	struct bone_gpio_event ev;
+
+	size_t done = 0;
+
+	ssize_t ret = 0;
+
+	int idx;
+
+	if(count < sizeof(ev))
+		return -EINVAL;
+
+	for(;;){
+		idx = gpio_cdev_enter(filp);
+		if(idx < 0)
+			return idx;
+
+		mutex_lock(&gpio_drv_data.event_read_lock);
+
+		while(done + sizeof(ev) <= count && (dev_data = gpio_events_oldest(&ev))){
+			if(copy_to_user(buf + done,&ev,sizeof(ev))){
+				ret = -EFAULT;
+				break;
+			}
+			kfifo_skip(&dev_data->events);
+			done += sizeof(ev);
+		}
+
+		mutex_unlock(&gpio_drv_data.event_read_lock);
+		gpio_cdev_exit(idx);
+
+		if(done || ret)
+			break;
+
+		if(filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(gpio_drv_data.event_wq,gpio_events_ready(filp));
+		if(ret)
+			return ret;
+	}
+
+	return done ? done : ret;
+}
+
+__poll_t gpio_events_poll(struct file *filp, poll_table *wait)
+{
+	__poll_t mask = 0;
+
+	int idx;
+
+	poll_wait(filp,&gpio_drv_data.event_wq,wait);
+
+	idx = gpio_cdev_enter(filp);
+	if(idx < 0)
+		return EPOLLERR | EPOLLHUP;
+
+	if(gpio_events_pending())
+		mask = EPOLLIN | EPOLLRDNORM;
+	gpio_cdev_exit(idx);
+
+	return mask;
+}
+
+void gpio_events_init(void)
+{
+	mutex_init(&gpio_drv_data.edge_lock);
+	mutex_init(&gpio_drv_data.event_read_lock);
+	gpio_drv_data.edges_removed = false;
+	init_waitqueue_head(&gpio_drv_data.event_wq);
+}
+
+/*free the interrupts of all lines, no edge can be set afterwards */
+void gpio_events_remove(void)
+{
+	int i;
+
+	mutex_lock(&gpio_drv_data.edge_lock);
+	gpio_drv_data.edges_removed = true;
+	for(i = 0 ; i < gpio_drv_data.total_devices ; i++)
+		gpio_event_set_edge(gpio_line_data(i),0);
+	mutex_unlock(&gpio_drv_data.edge_lock);
+}
@@ -0,0 +1,283 @@
+
+#include "gpio-sysfs.h"
+
+
+/*Logic analyzer sampling, see gpio_sysfs_ioctl.h. An hrtimer reads all the
+sampled lines with one gpiod_get_array_value per tick and appends the
+result to a ring which user space maps, so samples reach the reader without
+a system call or a wakeup. The ring never overwrites samples which were not
+consumed, a full ring drops new ones and counts them */
+
+struct gpio_sampler
+{
+	struct hrtimer timer;
+	ktime_t period;
+	struct gpio_lines lines;
+	/* vmalloc_user memory, the ring header and the samples after it */
+	void *mem;
+	unsigned long size;
+	struct bone_gpio_sample_ring *ring;
+	void *data;
+	u32 depth;
+	u32 sample_size;
+	u32 trigger;
+	u64 trigger_mask;
+	u64 trigger_values;
+	/* the previous sample, for an edge trigger */
+	u64 prev;
+	bool have_prev;
+	bool triggered;
+	bool running;
+	/* serializes setup, start, stop and mmap */
+	struct mutex lock;
+};
+
+static struct gpio_sampler gpio_sampler;
+
+static bool gpio_sample_triggered(struct gpio_sampler *s, u64 values)
+{
+	bool hit = false;
+
+	switch(s->trigger)
+	{
+		case BONE_GPIO_TRIGGER_NONE:
+			hit = true;
+			break;
+		case BONE_GPIO_TRIGGER_LEVEL:
+			hit = (values & s->trigger_mask) == s->trigger_values;
+			break;
+		case BONE_GPIO_TRIGGER_EDGE:
+			hit = s->have_prev && ((values ^ s->prev) & s->trigger_mask);
+			break;
+	}
+
+	s->prev = values;
+	s->have_prev = true;
+
+	return hit;
+}
+
+static void gpio_sample_store(struct gpio_sampler *s, u32 index, u64 values)
+{
+	switch(s->sample_size)
+	{
+		case 1:
+			((u8 *)s->data)[index] = values;
+			break;
+		case 2:
+			((u16 *)s->data)[index] = values;
+			break;
+		case 4:
+			((u32 *)s->data)[index] = values;
+			break;
+		default:
+			((u64 *)s->data)[index] = values;
+	}
+}
+
+static enum hrtimer_restart gpio_sample_timer(struct hrtimer *timer)
+{
+	struct gpio_sampler *s = container_of(timer,struct gpio_sampler,timer);
+
+	struct bone_gpio_sample_ring *ring = s->ring;
+
+	u64 overruns, values;
+
+	u32 head;
+
+	/*ticks which passed while the timer was late are lost */
+	overruns = hrtimer_forward_now(timer,s->period);
+	if(overruns > 1)
+		WRITE_ONCE(ring->missed,ring->missed + (u32)(overruns - 1));
+
+	if(gpio_lines_get(&s->lines,&values,false))
+		return HRTIMER_RESTART;
+
+	if(!s->triggered){
+		if(!gpio_sample_triggered(s,values))
+			return HRTIMER_RESTART;
+		s->triggered = true;
+		WRITE_ONCE(ring->trigger_ns,ktime_get_ns());
+	}
+
+	head = ring->head;
+
+	/*pairs with the release of tail by the reader, it is done with the slot */
+	if(head - smp_load_acquire(&ring->tail) >= s->depth){
+		WRITE_ONCE(ring->dropped,ring->dropped + 1);
+		return HRTIMER_RESTART;
+	}
+
+	gpio_sample_store(s,head & (s->depth - 1),values);
+
+	/*the reader sees the sample before the new head */
+	smp_store_release(&ring->head,head + 1);
+
+	return HRTIMER_RESTART;
+}
+
+static int gpio_sample_setup(struct bone_gpio_sample_params __user *uparams)
+{
+	struct gpio_sampler *s = &gpio_sampler;
+
+	struct bone_gpio_sample_params params;
+
+	unsigned long size;
+
+	u32 sample_size;
+
+	void *mem;
+
+	int bits;
+
+	if(copy_from_user(&params,uparams,sizeof(params)))
+		return -EFAULT;
+
+	/*samples are taken in hard interrupt context, so no line may sleep */
+	if(!params.mask || (params.mask & ~gpio_array_all_lines()) || gpio_array_cansleep(params.mask) ||
+	   params.period_ns < BONE_GPIO_SAMPLE_MIN_PERIOD_NS ||
+	   params.depth < 2 || params.depth > BONE_GPIO_SAMPLE_MAX_DEPTH ||
+	   !is_power_of_2(params.depth) || params.trigger > BONE_GPIO_TRIGGER_EDGE ||
+	   (params.trigger_mask & ~params.mask) || (params.trigger_values & ~params.trigger_mask))
+		return -EINVAL;
+
+	/*the smallest word which holds the highest sampled line */
+	bits = fls64(params.mask);
+	sample_size = (bits <= 8) ? 1 : (bits <= 16) ? 2 : (bits <= 32) ? 4 : 8;
+
+	size = PAGE_ALIGN(PAGE_SIZE + (unsigned long)params.depth * sample_size);
+
+	mem = vmalloc_user(size);
+	if(!mem)
+		return -ENOMEM;
+
+	mutex_lock(&s->lock);
+
+	if(s->running){
+		mutex_unlock(&s->lock);
+		vfree(mem);
+		return -EBUSY;
+	}
+
+	/*pages still mapped by user space stay around until they are unmapped */
+	vfree(s->mem);
+
+	s->mem = mem;
+	s->size = size;
+	s->ring = mem;
+	s->data = mem + PAGE_SIZE;
+	s->depth = params.depth;
+	s->sample_size = sample_size;
+	s->period = ns_to_ktime(params.period_ns);
+	s->trigger = params.trigger;
+	s->trigger_mask = params.trigger_mask;
+	s->trigger_values = params.trigger_values;
+	gpio_lines_pick(&s->lines,params.mask);
+
+	s->ring->depth = params.depth;
+	s->ring->sample_size = sample_size;
+	s->ring->period_ns = params.period_ns;
+	s->ring->data_offset = PAGE_SIZE;
+
+	mutex_unlock(&s->lock);
+
+	params.size = size;
+	if(copy_to_user(uparams,&params,sizeof(params)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/*starts over with an empty ring, waiting for the trigger */
+static int gpio_sample_start(void)
+{
+	struct gpio_sampler *s = &gpio_sampler;
+
+	struct bone_gpio_sample_ring *ring;
+
+	int ret = 0;
+
+	mutex_lock(&s->lock);
+
+	if(!s->mem){
+		ret = -EINVAL;
+	}else if(s->running){
+		ret = -EBUSY;
+	}else{
+		ring = s->ring;
+		ring->head = 0;
+		ring->tail = 0;
+		ring->dropped = 0;
+		ring->missed = 0;
+		ring->trigger_ns = 0;
+		s->have_prev = false;
+		s->triggered = false;
+		s->running = true;
+		hrtimer_start(&s->timer,ktime_get(),HRTIMER_MODE_ABS);
+	}
+
+	mutex_unlock(&s->lock);
+
+	return ret;
+}
+
+static void gpio_sample_stop(void)
+{
+	struct gpio_sampler *s = &gpio_sampler;
+
+	mutex_lock(&s->lock);
+	hrtimer_cancel(&s->timer);
+	s->running = false;
+	mutex_unlock(&s->lock);
+}
+
+long gpio_sample_ioctl(unsigned int cmd, void __user *argp)
+{
+	switch(cmd)
+	{
+		case BONE_GPIO_SAMPLE_SETUP:
+			return gpio_sample_setup(argp);
+		case BONE_GPIO_SAMPLE_START:
+			return gpio_sample_start();
+		case BONE_GPIO_SAMPLE_STOP:
+			gpio_sample_stop();
+			return 0;
+		default:
+			return -ENOTTY;
+	}
+}
+
+/*the ring of the last setup, from offset 0 */
+int gpio_sample_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct gpio_sampler *s = &gpio_sampler;
+
+	int ret;
+
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	mutex_lock(&s->lock);
+	if(s->mem)
+		ret = remap_vmalloc_range(vma,s->mem,vma->vm_pgoff);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&s->lock);
+
+	return ret;
+}
+
+void gpio_sample_init(void)
+{
+	mutex_init(&gpio_sampler.lock);
+	hrtimer_init(&gpio_sampler.timer,CLOCK_MONOTONIC,HRTIMER_MODE_ABS);
+	gpio_sampler.timer.function = gpio_sample_timer;
+}
+
+void gpio_sample_remove(void)
+{
+	gpio_sample_stop();
+
+	vfree(gpio_sampler.mem);
+	gpio_sampler.mem = NULL;
+}
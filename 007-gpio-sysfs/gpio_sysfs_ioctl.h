@@ -0,0 +1,164 @@
+#ifndef GPIO_SYSFS_IOCTL_H
+#define GPIO_SYSFS_IOCTL_H
+
+/* ioctl interface of /dev/bone_gpio, shared with user space */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define BONE_GPIO_IOC_MAGIC	'b'
+
+/*line i of the driver, in the order of the children of bone_gpio_devs in the
+device tree, is bit i of the masks. Its number is in the 'line' attribute of
+its class device */
+#define BONE_GPIO_MAX_LINES	64
+
+struct bone_gpio_values
+{
+	__u64 mask;	/* lines to act on */
+	__u64 values;	/* one bit per line */
+};
+
+/*
+ * GET_VALUES and SET_VALUES read and write the lines in 'mask' at once, lines
+ * of the same GPIO bank in a single register access. GET_DIRECTIONS sets a
+ * bit in 'values' for every output line in 'mask'. SET_DIRECTIONS makes the
+ * lines in 'mask' outputs where their bit is set and inputs where it is not,
+ * lines which become outputs start low.
+ */
+#define BONE_GPIO_GET_VALUES		_IOWR(BONE_GPIO_IOC_MAGIC, 1, struct bone_gpio_values)
+#define BONE_GPIO_SET_VALUES		_IOW(BONE_GPIO_IOC_MAGIC, 2, struct bone_gpio_values)
+#define BONE_GPIO_GET_DIRECTIONS	_IOWR(BONE_GPIO_IOC_MAGIC, 3, struct bone_gpio_values)
+#define BONE_GPIO_SET_DIRECTIONS	_IOW(BONE_GPIO_IOC_MAGIC, 4, struct bone_gpio_values)
+
+#define BONE_GPIO_LABEL_SIZE	32
+
+#define BONE_GPIO_LINE_OUTPUT	(1 << 0)
+
+/*
+ * GET_LINE_INFO fills in the rest of the structure for line 'line', so a
+ * program can build its table of lines once and then only use the calls
+ * above.
+ */
+struct bone_gpio_line_info
+{
+	__u32 line;
+	__u32 nr_lines;		/* lines of the driver */
+	__u32 flags;		/* BONE_GPIO_LINE_* */
+	__u32 reserved;
+	char label[BONE_GPIO_LABEL_SIZE];
+};
+
+#define BONE_GPIO_GET_LINE_INFO		_IOWR(BONE_GPIO_IOC_MAGIC, 5, struct bone_gpio_line_info)
+
+#define BONE_GPIO_EDGE_RISING	1
+#define BONE_GPIO_EDGE_FALLING	2
+
+/*
+ * Edge events, of the lines whose 'edge' attribute is rising, falling or
+ * both. read() on /dev/bone_gpio returns as many as fit, oldest first, and
+ * poll() tells when there are some. Every line queues up to 256 events, the
+ * ones which do not fit are counted in its 'overflows' attribute.
+ */
+struct bone_gpio_event
+{
+	__u64 ts_ns;	/* CLOCK_MONOTONIC, taken in the interrupt handler */
+	__u32 line;
+	__u32 edge;	/* BONE_GPIO_EDGE_* */
+};
+
+/*
+ * Waveform playback. WAVE_LOAD copies a list of steps into the driver, while
+ * no waveform plays. WAVE_START plays it from the first step: every step sets
+ * the lines in 'mask' to 'values', and the next one follows 'delta_ns' after
+ * it. With BONE_GPIO_WAVE_LOOP the first step follows the last one, else
+ * playback ends with the last step. WAVE_STOP ends playback early, the lines
+ * keep their values. A step applied after the next one was due counts as an
+ * underrun. A waveform may use at most 16 different masks, and no line of a
+ * GPIO chip which sleeps, such as an I2C or SPI expander.
+ */
+#define BONE_GPIO_WAVE_MAX_STEPS	65536
+#define BONE_GPIO_WAVE_MIN_DELTA_NS	1000
+
+#define BONE_GPIO_WAVE_LOOP		(1 << 0)
+
+struct bone_gpio_wave_step
+{
+	__u64 mask;
+	__u64 values;
+	__u64 delta_ns;
+};
+
+struct bone_gpio_wave
+{
+	__u64 steps;	/* user pointer to an array of struct bone_gpio_wave_step */
+	__u32 count;
+	__u32 flags;	/* BONE_GPIO_WAVE_* */
+};
+
+struct bone_gpio_wave_status
+{
+	__u32 running;
+	__u32 step;	/* next step to be played */
+	__u64 loops;
+	__u64 underruns;
+};
+
+#define BONE_GPIO_WAVE_LOAD		_IOW(BONE_GPIO_IOC_MAGIC, 6, struct bone_gpio_wave)
+#define BONE_GPIO_WAVE_START		_IO(BONE_GPIO_IOC_MAGIC, 7)
+#define BONE_GPIO_WAVE_STOP		_IO(BONE_GPIO_IOC_MAGIC, 8)
+#define BONE_GPIO_WAVE_STATUS		_IOR(BONE_GPIO_IOC_MAGIC, 9, struct bone_gpio_wave_status)
+
+/*
+ * Sampling. SAMPLE_SETUP allocates a ring of 'depth' samples of the lines in
+ * 'mask', taken every 'period_ns', and sets 'size' to the length to mmap()
+ * /dev/bone_gpio with. Like for waveforms, lines of chips which sleep are
+ * refused. SAMPLE_START empties the ring and takes samples from
+ * the first one which meets the trigger on, until SAMPLE_STOP. A LEVEL
+ * trigger waits for the lines in 'trigger_mask' to read 'trigger_values', an
+ * EDGE trigger for any of them to change.
+ *
+ * The mapping starts with struct bone_gpio_sample_ring, the samples are at
+ * 'data_offset'. A sample has the bits of the lines at their place in the
+ * masks, in the smallest of 1, 2, 4 or 8 bytes which holds them. The driver
+ * advances 'head' after a sample is written, the reader advances 'tail'
+ * after it is done with one, both count samples and wrap at 2^32. Samples
+ * which find the ring full are dropped, ticks the timer was too late for
+ * are missed.
+ */
+#define BONE_GPIO_SAMPLE_MAX_DEPTH	(1 << 20)
+#define BONE_GPIO_SAMPLE_MIN_PERIOD_NS	2000
+
+#define BONE_GPIO_TRIGGER_NONE		0
+#define BONE_GPIO_TRIGGER_LEVEL		1
+#define BONE_GPIO_TRIGGER_EDGE		2
+
+struct bone_gpio_sample_params
+{
+	__u64 mask;
+	__u64 trigger_mask;
+	__u64 trigger_values;
+	__u32 period_ns;
+	__u32 depth;		/* a power of two */
+	__u32 trigger;		/* BONE_GPIO_TRIGGER_* */
+	__u32 size;		/* out */
+};
+
+struct bone_gpio_sample_ring
+{
+	__u32 head;
+	__u32 tail;
+	__u32 dropped;
+	__u32 missed;
+	__u64 trigger_ns;	/* CLOCK_MONOTONIC, 0 until the trigger */
+	__u32 depth;
+	__u32 sample_size;
+	__u32 period_ns;
+	__u32 data_offset;
+};
+
+#define BONE_GPIO_SAMPLE_SETUP		_IOWR(BONE_GPIO_IOC_MAGIC, 10, struct bone_gpio_sample_params)
+#define BONE_GPIO_SAMPLE_START		_IO(BONE_GPIO_IOC_MAGIC, 11)
+#define BONE_GPIO_SAMPLE_STOP		_IO(BONE_GPIO_IOC_MAGIC, 12)
+
+#endif
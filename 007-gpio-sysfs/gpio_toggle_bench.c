@@ -0,0 +1,146 @@
+/*
+ * Toggle rate of one line through /sys/class/bone_gpios/<label>/value and
+ * through BONE_GPIO_SET_VALUES on /dev/bone_gpio, in toggles per second.
+ * The line must be an output, the driver makes all lines outputs at probe.
+ *
+ * Build with 'make bench', or on the target:
+ *	gcc -O2 -o gpio_toggle_bench gpio_toggle_bench.c
+ * Run:
+ *	./gpio_toggle_bench <label> [toggles]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpio_sysfs_ioctl.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*one write() of "0" or "1" per toggle, as a shell script would do it */
+static double bench_sysfs(const char *label, long toggles)
+{
+	char path[128];
+	double start;
+	long i;
+	int fd;
+
+	snprintf(path,sizeof(path),"/sys/class/bone_gpios/%s/value",label);
+	fd = open(path,O_WRONLY);
+	if(fd < 0){
+		perror(path);
+		return -1;
+	}
+
+	start = now();
+	for(i = 0 ; i < toggles ; i++){
+		if(pwrite(fd,(i & 1) ? "0" : "1",1,0) != 1){
+			perror("write");
+			close(fd);
+			return -1;
+		}
+	}
+
+	start = now() - start;
+	close(fd);
+
+	return toggles / start;
+}
+
+/*the bit of the line, from its label */
+static int find_line(int fd, const char *label)
+{
+	struct bone_gpio_line_info info;
+	unsigned int nr_lines = 1, line;
+
+	for(line = 0 ; line < nr_lines ; line++){
+		memset(&info,0,sizeof(info));
+		info.line = line;
+		if(ioctl(fd,BONE_GPIO_GET_LINE_INFO,&info) < 0){
+			perror("BONE_GPIO_GET_LINE_INFO");
+			return -1;
+		}
+		nr_lines = info.nr_lines;
+		if(!strcmp(info.label,label))
+			return line;
+	}
+
+	fprintf(stderr,"no line labelled %s\n",label);
+	return -1;
+}
+
+static double bench_ioctl(const char *label, long toggles)
+{
+	struct bone_gpio_values req;
+	double start;
+	long i;
+	int fd, line;
+
+	fd = open("/dev/bone_gpio",O_RDWR);
+	if(fd < 0){
+		perror("/dev/bone_gpio");
+		return -1;
+	}
+
+	line = find_line(fd,label);
+	if(line < 0){
+		close(fd);
+		return -1;
+	}
+
+	req.mask = 1ULL << line;
+
+	start = now();
+	for(i = 0 ; i < toggles ; i++){
+		req.values = (i & 1) ? 0 : req.mask;
+		if(ioctl(fd,BONE_GPIO_SET_VALUES,&req) < 0){
+			perror("BONE_GPIO_SET_VALUES");
+			close(fd);
+			return -1;
+		}
+	}
+
+	start = now() - start;
+	close(fd);
+
+	return toggles / start;
+}
+
+int main(int argc, char *argv[])
+{
+	long toggles = 100000;
+	double sysfs, dev;
+
+	if(argc < 2){
+		fprintf(stderr,"usage: %s <label> [toggles]\n",argv[0]);
+		return 1;
+	}
+
+	if(argc > 2)
+		toggles = atol(argv[2]);
+	if(toggles < 1){
+		fprintf(stderr,"bad toggle count\n");
+		return 1;
+	}
+
+	sysfs = bench_sysfs(argv[1],toggles);
+	dev = bench_ioctl(argv[1],toggles);
+	if(sysfs < 0 || dev < 0)
+		return 1;
+
+	printf("%-28s %12.0f toggles/s\n","sysfs value",sysfs);
+	printf("%-28s %12.0f toggles/s\n","/dev/bone_gpio SET_VALUES",dev);
+	printf("%-28s %12.1fx\n","speedup",dev / sysfs);
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+
+#include "gpio-sysfs.h"
+
+
+/*Waveform playback, see gpio_sysfs_ioctl.h. An hrtimer applies one step per
+expiry in interrupt context and arms itself for the next one, so nothing
+runs in user space during playback. Every step is due a fixed time after the
+previous one was due, not after it ran, so lateness does not add up over a
+long waveform. The lines of each distinct mask are picked when the waveform
+is loaded, a step is then a single gpiod_set_array_value */
+
+#define GPIO_WAVE_MAX_MASKS	16
+
+struct gpio_wave_step
+{
+	u64 values;
+	u64 delta_ns;
+	/* index in gpio_wave.lines */
+	unsigned int lines;
+};
+
+struct gpio_wave
+{
+	struct hrtimer timer;
+	struct gpio_wave_step *steps;
+	unsigned int nr_steps;
+	struct gpio_lines *lines;
+	bool loop;
+	/* owned by the timer while it runs */
+	bool running;
+	unsigned int step;
+	unsigned long loops;
+	unsigned long underruns;
+	/* serializes load, start and stop */
+	struct mutex lock;
+};
+
+static struct gpio_wave gpio_wave;
+
+static enum hrtimer_restart gpio_wave_timer(struct hrtimer *timer)
+{
+	struct gpio_wave *wave = container_of(timer,struct gpio_wave,timer);
+
+	struct gpio_wave_step *step = &wave->steps[wave->step];
+
+	ktime_t next;
+
+	gpio_lines_set(&wave->lines[step->lines],step->values,false);
+
+	if(++wave->step == wave->nr_steps){
+		if(!wave->loop){
+			WRITE_ONCE(wave->running,false);
+			return HRTIMER_NORESTART;
+		}
+		wave->step = 0;
+		WRITE_ONCE(wave->loops,wave->loops + 1);
+	}
+
+	/*a step which is due already will run as soon as we return */
+	next = ktime_add_ns(hrtimer_get_expires(timer),step->delta_ns);
+	if(ktime_before(next,hrtimer_cb_get_time(timer)))
+		WRITE_ONCE(wave->underruns,wave->underruns + 1);
+
+	hrtimer_set_expires(timer,next);
+
+	return HRTIMER_RESTART;
+}
+
+static int gpio_wave_load(struct bone_gpio_wave __user *uwave)
+{
+	struct gpio_wave *wave = &gpio_wave;
+
+	u64 all_lines = gpio_array_all_lines();
+
+	u64 masks[GPIO_WAVE_MAX_MASKS];
+
+	struct bone_gpio_wave_step *usteps;
+
+	struct gpio_wave_step *steps;
+
+	struct gpio_lines *lines;
+
+	struct bone_gpio_wave hdr;
+
+	unsigned int i, j, nr_masks = 0;
+
+	int ret = 0;
+
+	if(copy_from_user(&hdr,uwave,sizeof(hdr)))
+		return -EFAULT;
+
+	if(!hdr.count || hdr.count > BONE_GPIO_WAVE_MAX_STEPS || (hdr.flags & ~BONE_GPIO_WAVE_LOOP))
+		return -EINVAL;
+
+	usteps = vmemdup_user(u64_to_user_ptr(hdr.steps),hdr.count * sizeof(*usteps));
+	if(IS_ERR(usteps))
+		return PTR_ERR(usteps);
+
+	steps = kvmalloc_array(hdr.count,sizeof(*steps),GFP_KERNEL);
+	if(!steps){
+		ret = -ENOMEM;
+		goto free_usteps;
+	}
+
+	for(i = 0 ; i < hdr.count ; i++){
+		if(!usteps[i].mask || (usteps[i].mask & ~all_lines) ||
+		   usteps[i].delta_ns < BONE_GPIO_WAVE_MIN_DELTA_NS){
+			ret = -EINVAL;
+			goto free_steps;
+		}
+
+		for(j = 0 ; j < nr_masks ; j++){
+			if(masks[j] == usteps[i].mask)
+				break;
+		}
+		if(j == nr_masks){
+			if(nr_masks == GPIO_WAVE_MAX_MASKS){
+				ret = -E2BIG;
+				goto free_steps;
+			}
+			/*steps are applied in hard interrupt context */
+			if(gpio_array_cansleep(usteps[i].mask)){
+				ret = -EINVAL;
+				goto free_steps;
+			}
+			masks[nr_masks++] = usteps[i].mask;
+		}
+
+		steps[i].values = usteps[i].values;
+		steps[i].delta_ns = usteps[i].delta_ns;
+		steps[i].lines = j;
+	}
+
+	lines = kcalloc(nr_masks,sizeof(*lines),GFP_KERNEL);
+	if(!lines){
+		ret = -ENOMEM;
+		goto free_steps;
+	}
+
+	for(j = 0 ; j < nr_masks ; j++)
+		gpio_lines_pick(&lines[j],masks[j]);
+
+	mutex_lock(&wave->lock);
+
+	if(READ_ONCE(wave->running)){
+		mutex_unlock(&wave->lock);
+		kfree(lines);
+		ret = -EBUSY;
+		goto free_steps;
+	}
+
+	swap(wave->steps,steps);
+	swap(wave->lines,lines);
+	wave->nr_steps = hdr.count;
+	wave->loop = hdr.flags & BONE_GPIO_WAVE_LOOP;
+
+	mutex_unlock(&wave->lock);
+
+	/*the waveform loaded before, if any */
+	kfree(lines);
+
+free_steps:
+	kvfree(steps);
+free_usteps:
+	kvfree(usteps);
+	return ret;
+}
+
+static int gpio_wave_start(void)
+{
+	struct gpio_wave *wave = &gpio_wave;
+
+	int ret = 0;
+
+	mutex_lock(&wave->lock);
+
+	if(!wave->nr_steps){
+		ret = -EINVAL;
+	}else if(READ_ONCE(wave->running)){
+		ret = -EBUSY;
+	}else{
+		wave->step = 0;
+		wave->loops = 0;
+		wave->underruns = 0;
+		wave->running = true;
+		/*the first step right away */
+		hrtimer_start(&wave->timer,ktime_get(),HRTIMER_MODE_ABS);
+	}
+
+	mutex_unlock(&wave->lock);
+
+	return ret;
+}
+
+/*the lines keep the values of the last step played */
+static void gpio_wave_stop(void)
+{
+	struct gpio_wave *wave = &gpio_wave;
+
+	mutex_lock(&wave->lock);
+	hrtimer_cancel(&wave->timer);
+	WRITE_ONCE(wave->running,false);
+	mutex_unlock(&wave->lock);
+}
+
+static int gpio_wave_status(struct bone_gpio_wave_status __user *ustatus)
+{
+	struct gpio_wave *wave = &gpio_wave;
+
+	struct bone_gpio_wave_status status;
+
+	memset(&status,0,sizeof(status));
+	status.running = READ_ONCE(wave->running);
+	status.step = READ_ONCE(wave->step);
+	status.loops = READ_ONCE(wave->loops);
+	status.underruns = READ_ONCE(wave->underruns);
+
+	if(copy_to_user(ustatus,&status,sizeof(status)))
+		return -EFAULT;
+
+	return 0;
+}
+
+long gpio_wave_ioctl(unsigned int cmd, void __user *argp)
+{
+	switch(cmd)
+	{
+		case BONE_GPIO_WAVE_LOAD:
+			return gpio_wave_load(argp);
+		case BONE_GPIO_WAVE_START:
+			return gpio_wave_start();
+		case BONE_GPIO_WAVE_STOP:
+			gpio_wave_stop();
+			return 0;
+		case BONE_GPIO_WAVE_STATUS:
+			return gpio_wave_status(argp);
+		default:
+			return -ENOTTY;
+	}
+}
+
+void gpio_wave_init(void)
+{
+	mutex_init(&gpio_wave.lock);
+	hrtimer_init(&gpio_wave.timer,CLOCK_MONOTONIC,HRTIMER_MODE_ABS);
+	gpio_wave.timer.function = gpio_wave_timer;
+}
+
+void gpio_wave_remove(void)
+{
+	gpio_wave_stop();
+
+	kvfree(gpio_wave.steps);
+	kfree(gpio_wave.lines);
+	gpio_wave.steps = NULL;
+	gpio_wave.lines = NULL;
+	gpio_wave.nr_steps = 0;
+}